@@ -0,0 +1,460 @@
+#include <iostream>             // For input/output operations
+#include <fstream>              // For file handling
+#include <sstream>              // For string streams
+#include <vector>               // For dynamic arrays
+#include <string>               // For command lines and outputs
+#include <algorithm>            // For sorting latencies
+#include <cmath>                // For ceil
+#include <iomanip>              // For formatted output
+#include <chrono>               // For measuring time
+#include <thread>               // For feeding a child's input while its output is read
+#include <cstring>              // For strcmp
+#include <cstdlib>              // For realpath and strtol
+#include <climits>              // For PATH_MAX
+
+#include <unistd.h>             // For fork, exec, pipe and chdir
+#include <fcntl.h>              // For opening /dev/null
+#include <sys/wait.h>           // For waiting on children
+#include <sys/resource.h>       // For the peak memory of each child
+#include <sys/stat.h>           // For creating the batch output directory
+
+using namespace std;
+using namespace chrono;
+
+/*
+Benchmark runner for the search engines. It runs every engine mode over the query sets of a corpus directory made
+by generate, and reports per mode the throughput, the p50 and p99 latency, the peak memory and how many answers
+matched the reference. The reference is search-p with one thread: a full scan with no index and no pruning. A
+speedup that changes a single score or tie order shows up as a mismatch. --example checks both engines against
+data/results(example).txt of the repository instead.
+
+    bench DIR [--search PATH] [--search-p PATH] [--threads 1,2,4,8] [--runs R]
+    bench --example REPO [--search PATH] [--search-p PATH]
+
+Each one-shot mode starts one process per query, for the first R queries of a set (default 20), and its latency is
+the process wall time, loading included. Server and batch mode answer the whole set in one process; server latency
+is the per-query time the server reports. A query set where every answer is empty is reported as a failure, since its
+timings would not measure a search. POSIX only: children are started with fork and exec.
+*/
+struct RunResult {
+    double wallSeconds = 0;
+    long peakRSSKilobytes = 0;
+    int status = -1;
+    string output;                          // Everything the child wrote to stdout
+};
+
+// Function to run a program in a directory with the given stdin, capturing its stdout and measuring it
+RunResult runProgram(const vector<string>& args, const string& dir, const string& input) {
+    RunResult result;
+    int toChild[2];
+    int fromChild[2];
+    if (pipe(toChild) != 0 || pipe(fromChild) != 0) {
+        cerr << "Unable to create pipes" << endl;
+        return result;
+    }
+
+    auto start = steady_clock::now();
+    pid_t pid = fork();
+    if (pid == 0) {
+        dup2(toChild[0], STDIN_FILENO);
+        dup2(fromChild[1], STDOUT_FILENO);
+        int devNull = open("/dev/null", O_WRONLY);
+        dup2(devNull, STDERR_FILENO);
+        close(toChild[0]);
+        close(toChild[1]);
+        close(fromChild[0]);
+        close(fromChild[1]);
+        if (chdir(dir.c_str()) != 0) {
+            _exit(127);
+        }
+        vector<char*> argv;
+        for (const auto& arg : args) {
+            argv.push_back(const_cast<char*>(arg.c_str()));
+        }
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    close(toChild[0]);
+    close(fromChild[1]);
+
+    // Feed stdin from another thread so a child that answers while it reads can never block both sides
+    thread writer([&] {
+        size_t written = 0;
+        while (written < input.size()) {
+            ssize_t n = write(toChild[1], input.data() + written, input.size() - written);
+            if (n <= 0) {
+                break;
+            }
+            written += n;
+        }
+        close(toChild[1]);
+    });
+
+    char buffer[65536];
+    ssize_t n;
+    while ((n = read(fromChild[0], buffer, sizeof(buffer))) > 0) {
+        result.output.append(buffer, n);
+    }
+    close(fromChild[0]);
+    writer.join();
+
+    int status;
+    rusage usage;
+    wait4(pid, &status, 0, &usage);
+    result.wallSeconds = duration<double>(steady_clock::now() - start).count();
+    result.peakRSSKilobytes = usage.ru_maxrss;
+    result.status = WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+    return result;
+}
+
+// Function to read a whole file, empty if it cannot be opened
+string readFile(const string& filename) {
+    ifstream file(filename, ios::binary);
+    stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+// Function to read the non-empty lines of a query file
+vector<string> readQueries(const string& filename) {
+    ifstream file(filename);
+    vector<string> queries;
+    string line;
+    while (getline(file, line)) {
+        if (line.find_first_not_of(" \t\r") != string::npos) {
+            queries.push_back(line);
+        }
+    }
+    return queries;
+}
+
+// Function to split a query line into command line arguments
+vector<string> queryArgs(const string& query) {
+    stringstream fields(query);
+    vector<string> args;
+    string field;
+    while (fields >> field) {
+        args.push_back(field);
+    }
+    return args;
+}
+
+// Function to return the q-th quantile of a set of latencies (nearest rank)
+double quantile(vector<double> values, double q) {
+    if (values.empty()) {
+        return 0;
+    }
+    sort(values.begin(), values.end());
+    size_t rank = static_cast<size_t>(ceil(q * values.size()));
+    return values[rank > 0 ? rank - 1 : 0];
+}
+
+// Measurements of one mode over one query set
+struct ModeReport {
+    string name;
+    size_t queries = 0;
+    double seconds = 0;                     // Time spent answering, for the throughput
+    vector<double> latencies;               // Seconds per query
+    long peakRSSKilobytes = 0;
+    size_t checked = 0;
+    size_t mismatches = 0;
+    size_t answersWithResults = 0;          // Answers that list at least one document
+};
+
+void printReport(const ModeReport& report) {
+    cout << "  " << left << setw(32) << report.name << right << setw(7) << report.queries
+         << fixed << setprecision(1) << setw(12) << (report.seconds > 0 ? report.queries / report.seconds : 0)
+         << setprecision(3);
+    if (report.latencies.empty()) {
+        cout << setw(11) << "-" << setw(11) << "-";
+    } else {
+        cout << setw(11) << quantile(report.latencies, 0.5) * 1000 << setw(11) << quantile(report.latencies, 0.99) * 1000;
+    }
+    cout << setprecision(1) << setw(10) << report.peakRSSKilobytes / 1024.0
+         << "   " << (report.mismatches == 0 ? "ok" : "MISMATCH") << " (" << report.checked - report.mismatches << "/" << report.checked << ")" << endl;
+}
+
+// Function to run a one-shot mode once per query and compare each results.txt with the reference
+ModeReport runOneShot(const string& name, const vector<string>& command, const string& dir, const vector<string>& queries, const vector<string>& reference) {
+    ModeReport report;
+    report.name = name;
+    for (size_t q = 0; q < queries.size(); q++) {
+        vector<string> args = command;
+        for (const auto& arg : queryArgs(queries[q])) {
+            args.push_back(arg);
+        }
+        remove((dir + "/results.txt").c_str());
+        RunResult run = runProgram(args, dir, "");
+        report.queries++;
+        report.seconds += run.wallSeconds;
+        report.latencies.push_back(run.wallSeconds);
+        report.peakRSSKilobytes = max(report.peakRSSKilobytes, run.peakRSSKilobytes);
+        string results = readFile(dir + "/results.txt");
+        report.answersWithResults += !results.empty();
+        if (q < reference.size()) {
+            report.checked++;
+            report.mismatches += run.status != 0 || results != reference[q];
+        }
+    }
+    return report;
+}
+
+// Function to run server mode over a whole query set, taking each answer's own time as its latency
+ModeReport runServer(const string& searchPath, const string& dir, const vector<string>& queries, const vector<string>& reference) {
+    ModeReport report;
+    report.name = "search --index --serve";
+    string input;
+    for (const auto& query : queries) {
+        input += query + "\n";
+    }
+    RunResult run = runProgram({searchPath, "--index", "--serve"}, dir, input);
+    report.peakRSSKilobytes = run.peakRSSKilobytes;
+
+    // Answers are "Query: ...", the result lines, "Results: N Time taken: T microseconds" and an empty line
+    stringstream answers(run.output);
+    string line;
+    string results;
+    while (getline(answers, line)) {
+        if (line.compare(0, 7, "Query: ") == 0) {
+            results.clear();
+        } else if (line.compare(0, 9, "Results: ") == 0) {
+            size_t at = line.find("Time taken: ");
+            double seconds = at == string::npos ? 0 : stod(line.substr(at + 12)) / 1e6;
+            size_t q = report.queries++;
+            report.answersWithResults += strtol(line.c_str() + 9, nullptr, 10) > 0;
+            report.seconds += seconds;
+            report.latencies.push_back(seconds);
+            if (q < reference.size()) {
+                report.checked++;
+                report.mismatches += results != reference[q];
+            }
+        } else if (!line.empty()) {
+            results += line + "\n";
+        }
+    }
+    if (report.queries != queries.size()) {
+        report.mismatches += queries.size() - report.queries;
+        report.checked += queries.size() - report.queries;
+    }
+    return report;
+}
+
+// Function to find the wall time of a stage in a profile written with --profile: the stages are the objects of the
+// "stages" array, and nested objects (the per-worker breakdown) are skipped; false if the stage is not there
+bool profileStageSeconds(const string& profile, const string& stage, double& seconds) {
+    size_t pos = profile.find("\"stages\"");
+    pos = pos == string::npos ? pos : profile.find('[', pos);
+    if (pos == string::npos) {
+        return false;
+    }
+    int depth = 0;
+    size_t objectStart = 0;
+    for (pos++; pos < profile.size() && !(depth == 0 && profile[pos] == ']'); pos++) {
+        if (profile[pos] == '"') {
+            pos = profile.find('"', pos + 1);       // Stage names never contain escaped quotes
+            if (pos == string::npos) {
+                return false;
+            }
+        } else if (profile[pos] == '{' && depth++ == 0) {
+            objectStart = pos;
+        } else if (profile[pos] == '}' && --depth == 0) {
+            // Only the top-level keys of the stage object count; its nested objects come after them
+            string object = profile.substr(objectStart, pos + 1 - objectStart);
+            object = object.substr(0, object.find('{', 1));
+            size_t name = object.find("\"name\"");
+            size_t wall = object.find("\"wallSeconds\"");
+            if (name == string::npos || wall == string::npos) {
+                continue;
+            }
+            size_t nameStart = object.find('"', object.find(':', name) + 1);
+            size_t nameEnd = object.find('"', nameStart + 1);
+            if (nameStart != string::npos && nameEnd != string::npos && object.substr(nameStart + 1, nameEnd - nameStart - 1) == stage) {
+                seconds = strtod(object.c_str() + object.find(':', wall) + 1, nullptr);
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// Function to run batch mode over a whole query set, writing one results file per query
+ModeReport runBatch(const string& searchPath, const string& dir, const string& queryFile, const vector<string>& queries, const vector<string>& reference) {
+    ModeReport report;
+    report.name = "search --index --batch";
+    string outputDir = dir + "/bench-batch";
+    mkdir(outputDir.c_str(), 0755);
+    string profileFile = outputDir + "/profile.json";
+    RunResult run = runProgram({searchPath, "--profile", profileFile, "--index", "--batch", queryFile, "--output-dir", outputDir}, dir, "");
+    report.queries = queries.size();
+    report.peakRSSKilobytes = run.peakRSSKilobytes;
+
+    // Throughput counts the time spent answering, the "score" stage of the profile, without loading the index. If
+    // the profile has no such stage the process wall time is used instead, and the label says so. A batch has no
+    // per-query latency.
+    if (profileStageSeconds(readFile(profileFile), "score", report.seconds)) {
+        report.name += " [score]";
+    } else {
+        cerr << "Warning: no score stage in " << profileFile << ", batch throughput includes loading the index" << endl;
+        report.name += " [wall]";
+        report.seconds = run.wallSeconds;
+    }
+    for (size_t q = 0; q < queries.size(); q++) {
+        string results = readFile(outputDir + "/results" + to_string(q + 1) + ".txt");
+        report.answersWithResults += !results.empty();
+        if (q < reference.size()) {
+            report.checked++;
+            report.mismatches += run.status != 0 || results != reference[q];
+        }
+    }
+    return report;
+}
+
+// Function to turn a path into an absolute path, since the engines run inside the corpus directory
+string absolutePath(const string& path) {
+    char resolved[PATH_MAX];
+    return realpath(path.c_str(), resolved) != nullptr ? string(resolved) : path;
+}
+
+// Function to check both engines against the example results of the repository
+bool checkExample(const string& repo, const string& searchPath, const string& parallelPath) {
+    string query = readQueries(repo + "/data/input.txt").empty() ? "" : readQueries(repo + "/data/input.txt")[0];
+    string expected = readFile(repo + "/data/results(example).txt");
+    if (query.empty() || expected.empty()) {
+        cerr << "Unable to read data/input.txt and data/results(example).txt in " << repo << endl;
+        return false;
+    }
+
+    bool ok = true;
+    vector<pair<string, vector<string>>> modes = {
+        {"search", {searchPath}},
+        {"search-p --threads 1", {parallelPath, "--threads", "1"}},
+        {"search-p --threads 4", {parallelPath, "--threads", "4"}},
+    };
+    for (const auto& mode : modes) {
+        ModeReport report = runOneShot(mode.first, mode.second, repo, {query}, {expected});
+        cout << "  " << left << setw(28) << mode.first << (report.mismatches == 0 ? "matches" : "DIFFERS from") << " results(example).txt" << endl;
+        ok = ok && report.mismatches == 0;
+    }
+    return ok;
+}
+
+int main(int argc, char* argv[]) {
+    string searchPath = "./search";
+    string parallelPath = "./search-p";
+    vector<int> threadCounts = {1, 2, 4, 8};
+    size_t runs = 20;
+    string dir;
+    bool example = false;
+
+    for (int i = 1; i < argc; i++) {
+        string option = argv[i];
+        if (option == "--search" && i + 1 < argc) {
+            searchPath = argv[++i];
+        } else if (option == "--search-p" && i + 1 < argc) {
+            parallelPath = argv[++i];
+        } else if (option == "--threads" && i + 1 < argc) {
+            threadCounts.clear();
+            stringstream list(argv[++i]);
+            string count;
+            while (getline(list, count, ',')) {
+                threadCounts.push_back(max(1, atoi(count.c_str())));
+            }
+        } else if (option == "--runs" && i + 1 < argc) {
+            runs = max(1, atoi(argv[++i]));
+        } else if (option == "--example" && i + 1 < argc) {
+            example = true;
+            dir = argv[++i];
+        } else if (dir.empty() && option.compare(0, 2, "--") != 0) {
+            dir = option;
+        } else {
+            dir.clear();
+            break;
+        }
+    }
+    if (dir.empty() || threadCounts.empty()) {
+        cerr << "Usage: " << argv[0] << " DIR [--search PATH] [--search-p PATH] [--threads 1,2,4,8] [--runs R]" << endl;
+        cerr << "       " << argv[0] << " --example REPO [--search PATH] [--search-p PATH]" << endl;
+        return 1;
+    }
+    searchPath = absolutePath(searchPath);
+    parallelPath = absolutePath(parallelPath);
+    dir = absolutePath(dir);
+
+    if (example) {
+        return checkExample(dir, searchPath, parallelPath) ? 0 : 1;
+    }
+
+    // The saved index is built once and used by every indexed mode
+    RunResult build = runProgram({searchPath, "--build-index"}, dir, "");
+    if (build.status != 0) {
+        cerr << "Unable to build the index in " << dir << endl;
+        return 1;
+    }
+    cout << "Index built in " << fixed << setprecision(3) << build.wallSeconds << " s, peak memory "
+         << setprecision(1) << build.peakRSSKilobytes / 1024.0 << " MB" << endl;
+
+    bool allMatch = true;
+    bool allAnswered = true;
+    for (string kind : {"rare", "common", "mixed"}) {
+        string queryFile = dir + "/queries-" + kind + ".txt";
+        vector<string> queries = readQueries(queryFile);
+        if (queries.empty()) {
+            continue;
+        }
+        vector<string> sample(queries.begin(), queries.begin() + min(runs, queries.size()));
+
+        // Reference answers from the single-threaded full scan
+        vector<string> reference;
+        for (const auto& query : sample) {
+            vector<string> args = {parallelPath, "--threads", "1"};
+            for (const auto& arg : queryArgs(query)) {
+                args.push_back(arg);
+            }
+            remove((dir + "/results.txt").c_str());
+            runProgram(args, dir, "");
+            reference.push_back(readFile(dir + "/results.txt"));
+        }
+
+        cout << endl << kind << " queries (" << queries.size() << ", one-shot modes run the first " << sample.size() << ")" << endl;
+        cout << "  " << left << setw(32) << "mode" << right << setw(7) << "queries" << setw(12) << "queries/s"
+             << setw(11) << "p50 ms" << setw(11) << "p99 ms" << setw(10) << "peak MB" << "   check" << endl;
+
+        vector<ModeReport> reports;
+        reports.push_back(runOneShot("search", {searchPath}, dir, sample, reference));
+        reports.push_back(runOneShot("search --index", {searchPath, "--index"}, dir, sample, reference));
+        for (int threads : threadCounts) {
+            reports.push_back(runOneShot("search-p --threads " + to_string(threads), {parallelPath, "--threads", to_string(threads)}, dir, sample, reference));
+        }
+        reports.push_back(runServer(searchPath, dir, queries, reference));
+        reports.push_back(runBatch(searchPath, dir, queryFile, queries, reference));
+        size_t answersWithResults = 0;
+        for (const auto& report : reports) {
+            printReport(report);
+            allMatch = allMatch && report.mismatches == 0;
+            answersWithResults += report.answersWithResults;
+        }
+
+        // A set where no query matches anything times an empty workload, usually queries made for another corpus
+        if (answersWithResults == 0) {
+            cerr << "Warning: every " << kind << " query returned no results, its timings do not measure a search;"
+                 << " generate the queries again for this corpus" << endl;
+            allAnswered = false;
+        }
+
+        // Thread scaling of the full scan, relative to the first thread count
+        cout << "  search-p scaling:";
+        double base = quantile(reports[2].latencies, 0.5);
+        for (size_t t = 0; t < threadCounts.size(); t++) {
+            double median = quantile(reports[2 + t].latencies, 0.5);
+            cout << "  " << threadCounts[t] << " threads " << fixed << setprecision(2) << (median > 0 ? base / median : 0) << "x";
+        }
+        cout << endl;
+    }
+
+    cout << endl << (allMatch ? "All answers match the reference" : "Some answers differ from the reference") << endl;
+    if (!allAnswered) {
+        cout << "Some query sets returned no results for any query" << endl;
+    }
+    return allMatch && allAnswered ? 0 : 1;
+}
@@ -0,0 +1,281 @@
+#include <iostream>             // For input/output operations
+#include <fstream>              // For file handling
+#include <vector>               // For dynamic arrays
+#include <string>               // For the generated words
+#include <algorithm>            // For upper_bound
+#include <cmath>                // For pow and log
+#include <cstdint>              // For fixed-width integers
+#include <cstring>              // For comparing option names
+#include <cstdlib>              // For strtoull and strtod
+#include <random>               // For the mt19937_64 generator
+
+#ifndef _WIN32
+#include <sys/stat.h>           // For creating the output directories
+#endif
+
+using namespace std;
+
+/*
+Deterministic generator for benchmark corpora and query sets. The same options always produce byte-identical
+files on every platform: the only source of randomness is mt19937_64, whose output sequence is fixed by the C++
+standard, and every distribution is computed here instead of with the library's distributions, whose algorithms
+are implementation-defined.
+
+The vocabulary is a list of made-up words of the letters a-z; word r is the r-th most frequent. Terms are drawn
+from a Zipf distribution (probability proportional to 1 / (r + 1)^s), so a few words occur in almost every
+document and most words are rare, as in natural text. The most frequent words are the stopwords.
+
+    generate corpus DIR --docs N [--vocab V] [--words W] [--zipf S] [--seed X]
+        writes DIR/data/article.txt, DIR/data/dictionary.txt and DIR/data/stopwords.txt
+    generate queries DIR [--count Q] [--vocab V] [--seed X]
+        writes DIR/queries-rare.txt, DIR/queries-common.txt and DIR/queries-mixed.txt
+
+Queries for a generated corpus take the vocabulary size from its DIR/data/dictionary.txt, so that every query word
+is in the corpus; --vocab is only needed when there is no corpus yet.
+*/
+struct Options {
+    uint64_t docs = 10000;
+    uint64_t vocab = 50000;
+    bool vocabGiven = false;        // Whether --vocab was on the command line
+    double words = 250;             // Mean document length in words
+    double zipf = 1.0;
+    uint64_t seed = 1;
+    uint64_t count = 1000;          // Queries per query set
+};
+
+// Function to return a uniform double in [0, 1) from the raw generator output
+double uniform(mt19937_64& random) {
+    return (random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+// Function to return a uniform integer in [0, n)
+uint64_t uniformBelow(mt19937_64& random, uint64_t n) {
+    return static_cast<uint64_t>(uniform(random) * n);
+}
+
+// Function to build word r of the vocabulary: bijective base 26, offset so that every word has at least two letters
+string wordFor(uint64_t rank) {
+    string word;
+    for (uint64_t n = rank + 27; n > 0; n = (n - 1) / 26) {
+        word.push_back(static_cast<char>('a' + (n - 1) % 26));
+    }
+    return word;
+}
+
+// Function to return the number of stopwords for a vocabulary: the most frequent words
+uint64_t stopwordCount(uint64_t vocab) {
+    return min<uint64_t>(100, vocab / 20);
+}
+
+// Function to build the cumulative Zipf distribution over the ranks
+vector<double> zipfCDF(uint64_t vocab, double s) {
+    vector<double> cdf(vocab);
+    double total = 0;
+    for (uint64_t r = 0; r < vocab; r++) {
+        total += 1.0 / pow(static_cast<double>(r + 1), s);
+        cdf[r] = total;
+    }
+    for (double& value : cdf) {
+        value /= total;
+    }
+    return cdf;
+}
+
+// Function to draw a rank from the Zipf distribution
+uint64_t drawRank(mt19937_64& random, const vector<double>& cdf) {
+    uint64_t rank = upper_bound(cdf.begin(), cdf.end(), uniform(random)) - cdf.begin();
+    return min<uint64_t>(rank, cdf.size() - 1);
+}
+
+// Function to create a directory if it does not exist yet
+void makeDirectory(const string& path) {
+#ifndef _WIN32
+    mkdir(path.c_str(), 0755);
+#else
+    string command = "mkdir \"" + path + "\" 2> nul";
+    system(command.c_str());
+#endif
+}
+
+/*
+Every document is an ID line followed by lines of about twelve words. To exercise the tokenizer like real articles
+do, some words are capitalized, sentences end with punctuation, and about one token in twenty is a number, which
+preprocessing drops. Document lengths follow an exponential distribution around the mean, with at least ten words.
+*/
+bool generateCorpus(const string& dir, const Options& options) {
+    makeDirectory(dir);
+    makeDirectory(dir + "/data");
+
+    ofstream dictionary(dir + "/data/dictionary.txt");
+    ofstream stopwords(dir + "/data/stopwords.txt");
+    ofstream articles(dir + "/data/article.txt", ios::binary);
+    if (!dictionary.is_open() || !stopwords.is_open() || !articles.is_open()) {
+        cerr << "Unable to open file in " << dir << "/data" << endl;
+        return false;
+    }
+
+    vector<string> words(options.vocab);
+    for (uint64_t r = 0; r < options.vocab; r++) {
+        words[r] = wordFor(r);
+        dictionary << words[r] << "\n";
+        if (r < stopwordCount(options.vocab)) {
+            stopwords << words[r] << "\n";
+        }
+    }
+
+    mt19937_64 random(options.seed);
+    vector<double> cdf = zipfCDF(options.vocab, options.zipf);
+    string buffer;
+    uint64_t totalWords = 0;
+    for (uint64_t d = 0; d < options.docs; d++) {
+        buffer += (d == 0 ? "\n" : "\x0C\n");
+        buffer += "bench-" + to_string(d + 1) + "\n";
+
+        uint64_t length = 10 + static_cast<uint64_t>(-log(1 - uniform(random)) * max(0.0, options.words - 10));
+        for (uint64_t w = 0; w < length; w++) {
+            if (uniformBelow(random, 20) == 0) {
+                buffer += to_string(uniformBelow(random, 100000));
+            } else {
+                string word = words[drawRank(random, cdf)];
+                if (uniformBelow(random, 10) == 0) {
+                    word[0] = static_cast<char>(word[0] - 'a' + 'A');
+                }
+                buffer += word;
+            }
+            buffer += (w + 1 == length || w % 12 == 11) ? (uniformBelow(random, 3) == 0 ? ".\n" : "\n") : (uniformBelow(random, 15) == 0 ? ", " : " ");
+        }
+        totalWords += length;
+
+        if (buffer.size() >= (1 << 20)) {
+            articles.write(buffer.data(), buffer.size());
+            buffer.clear();
+        }
+    }
+    articles.write(buffer.data(), buffer.size());
+
+    if (!articles || !dictionary || !stopwords) {
+        cerr << "Unable to write the corpus to " << dir << "/data" << endl;
+        return false;
+    }
+    cout << "Generated " << options.docs << " documents, " << totalWords << " words, vocabulary of " << options.vocab
+         << " words (" << stopwordCount(options.vocab) << " stopwords) in " << dir << "/data" << endl;
+    return true;
+}
+
+// Function to count the words of a dictionary written by generateCorpus; false if it cannot be opened or was not
+// written by it, since the query words are only in the corpus when word r of the dictionary is wordFor(r)
+bool readVocabularySize(const string& filename, uint64_t& vocab, bool& generated) {
+    ifstream dictionary(filename);
+    if (!dictionary.is_open()) {
+        return false;
+    }
+    string word;
+    vocab = 0;
+    generated = true;
+    while (getline(dictionary, word)) {
+        generated = generated && word == wordFor(vocab);
+        vocab++;
+    }
+    return true;
+}
+
+/*
+Query sets: rare queries use words from the less frequent half of the vocabulary, common queries use the most
+frequent words that are not stopwords, and mixed queries combine both. Every query has one to four keywords and
+asks for 5, 10, 50 or 100 results.
+*/
+bool generateQueries(const string& dir, Options options) {
+    string dictionaryFile = dir + "/data/dictionary.txt";
+    uint64_t dictionaryWords;
+    bool generated;
+    if (readVocabularySize(dictionaryFile, dictionaryWords, generated)) {
+        if (!generated) {
+            cerr << dictionaryFile << " was not written by generate corpus, its words would not match the queries" << endl;
+            return false;
+        }
+        if (options.vocabGiven && options.vocab != dictionaryWords) {
+            cerr << "--vocab " << options.vocab << " differs from the " << dictionaryWords << " words of " << dictionaryFile << endl;
+            return false;
+        }
+        options.vocab = dictionaryWords;
+    }
+
+    makeDirectory(dir);
+    uint64_t firstWord = stopwordCount(options.vocab);
+    uint64_t commonWords = min<uint64_t>(200, options.vocab - firstWord);
+    uint64_t rareStart = max(firstWord + commonWords, options.vocab / 2);
+    if (rareStart >= options.vocab) {
+        cerr << "The vocabulary is too small for rare queries" << endl;
+        return false;
+    }
+    const int numResults[] = {5, 10, 50, 100};
+
+    mt19937_64 random(options.seed);
+    for (string kind : {"rare", "common", "mixed"}) {
+        string filename = dir + "/queries-" + kind + ".txt";
+        ofstream queries(filename);
+        if (!queries.is_open()) {
+            cerr << "Unable to open file " << filename << endl;
+            return false;
+        }
+        for (uint64_t q = 0; q < options.count; q++) {
+            queries << numResults[uniformBelow(random, 4)];
+            uint64_t keywords = 1 + uniformBelow(random, 4);
+            for (uint64_t k = 0; k < keywords; k++) {
+                bool rare = kind == "rare" || (kind == "mixed" && k % 2 == 1);
+                uint64_t rank = rare ? rareStart + uniformBelow(random, options.vocab - rareStart) : firstWord + uniformBelow(random, commonWords);
+                queries << " " << wordFor(rank);
+            }
+            queries << "\n";
+        }
+    }
+    cout << "Generated " << options.count << " rare, common and mixed queries over a vocabulary of " << options.vocab
+         << " words in " << dir << endl;
+    return true;
+}
+
+void printUsage(const char* program) {
+    cerr << "Usage: " << program << " corpus DIR --docs N [--vocab V] [--words W] [--zipf S] [--seed X]" << endl;
+    cerr << "       " << program << " queries DIR [--count Q] [--vocab V] [--seed X]" << endl;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3 || (strcmp(argv[1], "corpus") != 0 && strcmp(argv[1], "queries") != 0)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    Options options;
+    for (int i = 3; i < argc; i++) {
+        string option = argv[i];
+        if (i + 1 >= argc) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        const char* value = argv[++i];
+        if (option == "--docs") {
+            options.docs = strtoull(value, nullptr, 10);
+        } else if (option == "--vocab") {
+            options.vocab = strtoull(value, nullptr, 10);
+            options.vocabGiven = true;
+        } else if (option == "--words") {
+            options.words = strtod(value, nullptr);
+        } else if (option == "--zipf") {
+            options.zipf = strtod(value, nullptr);
+        } else if (option == "--seed") {
+            options.seed = strtoull(value, nullptr, 10);
+        } else if (option == "--count") {
+            options.count = strtoull(value, nullptr, 10);
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.vocab < 100 || options.docs == 0) {
+        cerr << "Use at least 100 vocabulary words and one document" << endl;
+        return 1;
+    }
+
+    bool generated = strcmp(argv[1], "corpus") == 0 ? generateCorpus(argv[2], options) : generateQueries(argv[2], options);
+    return generated ? 0 : 1;
+}
@@ -1,6 +1,5 @@
 #include <iostream>             // For input/output operations
 #include <fstream>              // For file handling
-#include <sstream>              // For string streams
 #include <vector>               // For dynamic arrays
 #include <unordered_set>        // For hash-based sets (dictionary and stopwords)
 #include <unordered_map>        // For hash-based maps
@@ -9,12 +8,48 @@
 #include <iomanip>              // For formatted input/output
 #include <cctype>               // For character classification
 #include <chrono>               // For measuring time
+#include <string_view>          // For zero-copy views into the mapped article file
+#include <cstdint>              // For fixed-width term IDs
+#include <cstring>              // For comparing words in the token filter
 #include <thread>               // For multi-threading
-#include <mutex>               // For mutexes (shared memory protection)
+#include <mutex>                // For the work queues of the thread pool
+#include <condition_variable>   // For waking the pool workers
+#include <atomic>               // For the steal counter
+#include <deque>                // For the per-worker chunk queues
+#include <functional>           // For the phase bodies run by the pool
+#include <cstdlib>              // For getenv and strtol
+#include <ctime>                // For the CPU time of each worker thread
+#include <memory>               // For unique_ptr
+#include <memory_resource>      // For the per-worker arenas holding the term tables
+#include <filesystem>           // For listing the article files of a directory
+
+#ifdef __SSE2__
+#include <emmintrin.h>          // For scanning 16 bytes at a time in the tokenizer
+#endif
+
+#ifndef _WIN32
+#include <fcntl.h>              // For open
+#include <unistd.h>             // For pread and close
+#include <glob.h>               // For article file patterns
+#include <sys/resource.h>       // For the CPU time and peak memory of the profiled stages
+#endif
+
+#ifdef __linux__
+#include <dirent.h>             // For listing the NUMA nodes in sysfs
+#include <pthread.h>            // For pinning the workers to CPUs
+#include <sched.h>              // For the CPU affinity of the process and sched_getcpu
+#endif
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define SEARCH_IO_URING
+#include <linux/io_uring.h>     // For reading the articles through io_uring
+#include <sys/mman.h>           // For mapping the io_uring rings
+#include <sys/syscall.h>        // For the io_uring system calls
+#include <cerrno>               // For EINTR
+#endif
 
 using namespace std;
 using namespace chrono;
-mutex dfMutex; // Mutex for protecting shared resource df
 
 /*
 Using an unordered_set for both stopwords and dictionary words because it allows O(1) average time complexity
@@ -33,255 +68,1700 @@ unordered_set<string> readWords(const string& filename) {
 }
 
 /*
-Using a vector of pair<string, string> to store the documents. Each pair consists of the document ID and its content. 
+Every dictionary word that is not a stopword is interned once as a dense 32-bit term ID. After preprocessing,
+documents, TF tables, IDF values and query keywords all refer to terms by ID, so the scoring loop never hashes or
+compares strings. IDs follow the sorted order of the words, which keeps them (and the index file) reproducible.
 */
-vector<pair<string, string>> readArticles(const string& filename) {
-    vector<pair<string, string>> documents;
-    ifstream file(filename);
-    if (!file.is_open()) {
-        cerr << "Unable to open file " << filename << endl;
-        return documents;
+const uint32_t NO_TERM = UINT32_MAX;
+
+struct Vocabulary {
+    vector<string> terms;                       // term ID -> word
+    unordered_map<string_view, uint32_t> ids;   // word -> term ID, the keys point into terms
+
+    Vocabulary() = default;
+    Vocabulary(const Vocabulary&) = delete;
+    Vocabulary& operator=(const Vocabulary&) = delete;
+    Vocabulary(Vocabulary&&) = default;
+    Vocabulary& operator=(Vocabulary&&) = default;
+};
+
+// Function to index the words of a vocabulary once its term list is complete
+void finishVocabulary(Vocabulary& vocabulary) {
+    vocabulary.ids.clear();
+    vocabulary.ids.reserve(vocabulary.terms.size());
+    for (uint32_t id = 0; id < vocabulary.terms.size(); id++) {
+        vocabulary.ids.emplace(vocabulary.terms[id], id);
+    }
+}
+
+// Function to build the vocabulary of words kept by preprocessing: dictionary words that are not stopwords
+Vocabulary buildVocabulary(const unordered_set<string>& dictionary, const unordered_set<string>& stopwords) {
+    Vocabulary vocabulary;
+    for (const auto& word : dictionary) {
+        if (stopwords.find(word) == stopwords.end()) {
+            vocabulary.terms.push_back(word);
+        }
+    }
+    sort(vocabulary.terms.begin(), vocabulary.terms.end());
+    finishVocabulary(vocabulary);
+    return vocabulary;
+}
+
+// Function to find the term ID of a word, or NO_TERM if preprocessing never keeps it
+uint32_t lookupTerm(const Vocabulary& vocabulary, string_view word) {
+    auto it = vocabulary.ids.find(word);
+    return it == vocabulary.ids.end() ? NO_TERM : it->second;
+}
+
+// Function to map query keywords to term IDs, keeping their order (and repetitions) for scoring
+vector<uint32_t> lookupKeywords(const Vocabulary& vocabulary, const vector<string>& keywords) {
+    vector<uint32_t> keywordIds;
+    for (const auto& keyword : keywords) {
+        keywordIds.push_back(lookupTerm(vocabulary, keyword));
+    }
+    return keywordIds;
+}
+
+/*
+The token filter answers "does preprocessing keep this word, and with which term ID?" with a single probe. It is a
+perfect hash over the vocabulary (dictionary words minus stopwords), built once at startup: every word is hashed
+to a bucket, and each bucket stores a displacement chosen so that its words land in distinct, otherwise unused
+slots. A lookup hashes the word once, reads its bucket's displacement, and compares against the one word stored in
+that slot, so rejecting a token costs no allocation and no chain walking. Only words made of the letters a-z can
+ever be produced by the tokenizer, so other dictionary entries are left out.
+*/
+struct FilterSlot {
+    uint32_t id = NO_TERM;      // Term ID of the word stored in this slot, NO_TERM if the slot is empty
+    uint32_t offset = 0;        // Position of the word in TermFilter::chars
+    uint32_t length = 0;
+};
+
+struct TermFilter {
+    vector<uint32_t> displacements;     // bucket -> displacement that spreads its words over free slots
+    vector<FilterSlot> slots;
+    string chars;                       // All filtered words, back to back
+    size_t maxLength = 0;               // Longer tokens are rejected without hashing
+};
+
+// Function to hash a word, reading it 8 bytes at a time
+inline uint64_t hashWord(const char* word, size_t length) {
+    uint64_t h = length * 0x9E3779B97F4A7C15ULL;
+    for (; length >= 8; word += 8, length -= 8) {
+        uint64_t chunk;
+        memcpy(&chunk, word, 8);
+        h = (h ^ chunk) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+    if (length > 0) {
+        uint64_t chunk = 0;
+        memcpy(&chunk, word, length);
+        h = (h ^ chunk) * 0xC4CEB9FE1A85EC53ULL;
+        h ^= h >> 29;
     }
+    return h;
+}
 
-    // Read the entire file content
-    string fileContent((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
-    file.close();
+// Function to pick a word's slot for a given bucket displacement
+inline size_t filterSlot(uint64_t hash, uint32_t displacement, size_t numSlots) {
+    uint64_t h = hash + displacement * 0x9E3779B97F4A7C15ULL;
+    h = (h ^ (h >> 33)) * 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return static_cast<size_t>(h % numSlots);
+}
 
-    // Split content by Form Feed character (\x0C)
-    stringstream ss(fileContent);
-    string document;
-    while (getline(ss, document, '\x0C')) {
-        if (!document.empty()) {
-            // Remove leading whitespace
-            document.erase(document.begin(), find_if(document.begin(), document.end(), [](int ch) {
-                return !isspace(ch);
-            }));
+inline size_t filterBucket(uint64_t hash, size_t numBuckets) {
+    return static_cast<size_t>((hash >> 32) % numBuckets);
+}
 
-            // Split the document into lines
-            stringstream docStream(document);
-            string docID;
-            getline(docStream, docID); // The first line is the document ID
+// Function to compile the vocabulary into the perfect-hash token filter
+TermFilter buildTermFilter(const Vocabulary& vocabulary) {
+    TermFilter filter;
+    vector<uint32_t> ids;
+    for (uint32_t id = 0; id < vocabulary.terms.size(); id++) {
+        const string& word = vocabulary.terms[id];
+        if (!word.empty() && all_of(word.begin(), word.end(), [](char c) { return c >= 'a' && c <= 'z'; })) {
+            ids.push_back(id);
+            filter.maxLength = max(filter.maxLength, word.size());
+        }
+    }
 
-            string content;
-            string line;
-            while (getline(docStream, line)) {
-                content += line + " ";
+    // About four words per bucket and a load factor of 0.8 keep the displacement search short
+    size_t numBuckets = ids.size() / 4 + 1;
+    size_t numSlots = ids.size() + ids.size() / 4 + 1;
+    vector<vector<pair<uint64_t, uint32_t>>> buckets(numBuckets);   // <hash, term ID>
+    for (uint32_t id : ids) {
+        uint64_t hash = hashWord(vocabulary.terms[id].data(), vocabulary.terms[id].size());
+        buckets[filterBucket(hash, numBuckets)].emplace_back(hash, id);
+    }
+
+    // Place the largest buckets first, while the table is still mostly empty
+    vector<size_t> order(numBuckets);
+    for (size_t b = 0; b < numBuckets; b++) {
+        order[b] = b;
+    }
+    sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return buckets[a].size() > buckets[b].size();
+    });
+
+    filter.displacements.assign(numBuckets, 0);
+    filter.slots.assign(numSlots, FilterSlot());
+    vector<size_t> chosen;
+    for (size_t b : order) {
+        if (buckets[b].empty()) {
+            break;
+        }
+        for (uint32_t displacement = 0;; displacement++) {
+            chosen.clear();
+            bool fits = true;
+            for (const auto& entry : buckets[b]) {
+                size_t slot = filterSlot(entry.first, displacement, numSlots);
+                if (filter.slots[slot].id != NO_TERM || find(chosen.begin(), chosen.end(), slot) != chosen.end()) {
+                    fits = false;
+                    break;
+                }
+                chosen.push_back(slot);
+            }
+            if (fits) {
+                filter.displacements[b] = displacement;
+                for (size_t i = 0; i < chosen.size(); i++) {
+                    filter.slots[chosen[i]].id = buckets[b][i].second;
+                }
+                break;
             }
+        }
+    }
+
+    // Store the words next to each other in slot order so a probe touches as little memory as possible
+    for (auto& slot : filter.slots) {
+        if (slot.id != NO_TERM) {
+            const string& word = vocabulary.terms[slot.id];
+            slot.offset = static_cast<uint32_t>(filter.chars.size());
+            slot.length = static_cast<uint32_t>(word.size());
+            filter.chars += word;
+        }
+    }
+
+    return filter;
+}
 
-            // Trim trailing whitespace from content
-            if (!content.empty() && content.back() == ' ') {
-                content.pop_back();
+// Function to find the term ID of a lowercase token, or NO_TERM if preprocessing drops it
+inline uint32_t filterTerm(const TermFilter& filter, const char* word, size_t length) {
+    if (length > filter.maxLength || filter.slots.empty()) {
+        return NO_TERM;
+    }
+    uint64_t hash = hashWord(word, length);
+    uint32_t displacement = filter.displacements[filterBucket(hash, filter.displacements.size())];
+    const FilterSlot& slot = filter.slots[filterSlot(hash, displacement, filter.slots.size())];
+    if (slot.length == length && memcmp(filter.chars.data() + slot.offset, word, length) == 0) {
+        return slot.id;
+    }
+    return NO_TERM;
+}
+
+/*
+Preprocessing, TF counting and DF counting happen in a single pass over the raw text: each alphabetic run is
+lowercased, looked up in the token filter and counted straight away, without building a cleaned string that would
+have to be tokenized again. The counts live in a dense per-thread scratch array indexed by term ID; only the
+entries touched by the current document are read back and reset, so the cost stays proportional to the document.
+*/
+struct TermCounter {
+    vector<uint32_t> counts;    // term ID -> occurrences in the current document, zero between documents
+    vector<uint32_t> touched;   // term IDs with a non-zero count
+    vector<char> word;          // Lowercased copy of the current token, with room for a 16-byte store
+
+    TermCounter(size_t numTerms, size_t maxLength) : counts(numTerms, 0), word(maxLength + 16) {}
+};
+
+// Function to count the token text[start, end) if preprocessing keeps it (a dictionary word that is not a stopword)
+inline void countWord(const char* text, size_t start, size_t end, size_t textLength, const TermFilter& filter, TermCounter& counter, uint32_t& totalWords) {
+    size_t length = end - start;
+    if (length > filter.maxLength) {
+        return;
+    }
+
+    // Letters are lowercased by setting bit 0x20
+#ifdef __SSE2__
+    if (start + 16 <= textLength) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + start));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(counter.word.data()), _mm_or_si128(bytes, _mm_set1_epi8(0x20)));
+        for (size_t i = 16; i < length; i++) {
+            counter.word[i] = text[start + i] | 0x20;
+        }
+    } else
+#endif
+    {
+        (void)textLength;
+        for (size_t i = 0; i < length; i++) {
+            counter.word[i] = text[start + i] | 0x20;
+        }
+    }
+
+    uint32_t id = filterTerm(filter, counter.word.data(), length);
+    if (id != NO_TERM) {
+        if (counter.counts[id]++ == 0) {
+            counter.touched.push_back(id);
+        }
+        totalWords++;
+    }
+}
+
+// Function to test for an ASCII letter, the same set isalpha accepts in the default "C" locale
+inline bool isLetter(char c) {
+    return static_cast<unsigned char>((c | 0x20) - 'a') < 26;
+}
+
+#ifdef __SSE2__
+// Function to return a 16-bit mask with bit i set when block[i] is an ASCII letter
+inline uint32_t letterMask(const char* block) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+    // (c | 0x20) - 'a' < 26, as a signed compare after shifting the range down by 128
+    __m128i shifted = _mm_add_epi8(_mm_or_si128(bytes, _mm_set1_epi8(0x20)), _mm_set1_epi8(static_cast<char>(-'a' - 128)));
+    __m128i letters = _mm_cmplt_epi8(shifted, _mm_set1_epi8(static_cast<char>(26 - 128)));
+    return static_cast<uint32_t>(_mm_movemask_epi8(letters));
+}
+#endif
+
+/*
+A document's term table is an array of <term ID, count> pairs sorted by term ID. Only the raw counts are stored;
+TF is count / totalWords * 100, computed when a score needs it, so the table stays small and exact.
+
+The tables are not separate vectors: every worker carves the tables of its documents out of its own monotonic
+arena, which grabs memory from the system in large, growing blocks. Preprocessing then makes a few dozen
+allocations per worker instead of one per document, workers never contend on the global allocator, and all the
+tables are released together when the arenas go away.
+*/
+struct TermTable {
+    const pair<uint32_t, uint32_t>* entries = nullptr;
+    uint32_t size = 0;
+
+    const pair<uint32_t, uint32_t>* begin() const {
+        return entries;
+    }
+
+    const pair<uint32_t, uint32_t>* end() const {
+        return entries + size;
+    }
+};
+
+const size_t ARENA_BLOCK = 1 << 20;    // Bytes of the first block of each arena; later blocks grow geometrically
+
+// Function to preprocess text: convert to lowercase, remove non-alphabetic characters, remove stopwords and non-dictionary
+// words and count the remaining terms into a table allocated from the arena. Returns the number of words kept (the document length).
+uint32_t preProcessText(string_view text, const TermFilter& filter, TermCounter& counter, pmr::monotonic_buffer_resource& arena, TermTable& tf) {
+    const char* data = text.data();
+    size_t length = text.size();
+    uint32_t totalWords = 0;
+    bool inWord = false;
+    size_t wordStart = 0;
+    size_t pos = 0;
+
+#ifdef __SSE2__
+    // Find word boundaries 16 bytes at a time: each set bit in the mask is a letter
+    for (; pos + 16 <= length; pos += 16) {
+        uint32_t letters = letterMask(data + pos);
+        uint32_t bit = 0;
+        while (bit < 16) {
+            uint32_t remaining = (inWord ? ~letters : letters) & (0xFFFFu << bit) & 0xFFFFu;
+            if (remaining == 0) {
+                break;
             }
+            bit = __builtin_ctz(remaining);
+            if (inWord) {
+                countWord(data, wordStart, pos + bit, length, filter, counter, totalWords);
+            } else {
+                wordStart = pos + bit;
+            }
+            inWord = !inWord;
+        }
+    }
+#endif
+
+    // The tail (or the whole text without SSE2) one byte at a time
+    for (; pos < length; pos++) {
+        if (isLetter(data[pos]) != inWord) {
+            if (inWord) {
+                countWord(data, wordStart, pos, length, filter, counter, totalWords);
+            } else {
+                wordStart = pos;
+            }
+            inWord = !inWord;
+        }
+    }
+
+    // Process the last word
+    if (inWord) {
+        countWord(data, wordStart, length, length, filter, counter, totalWords);
+    }
+
+    // Emit the term table in term ID order and reset the scratch counts for the next document
+    sort(counter.touched.begin(), counter.touched.end());
+    auto* entries = static_cast<pair<uint32_t, uint32_t>*>(arena.allocate(counter.touched.size() * sizeof(pair<uint32_t, uint32_t>), alignof(pair<uint32_t, uint32_t>)));
+    for (size_t i = 0; i < counter.touched.size(); i++) {
+        uint32_t id = counter.touched[i];
+        entries[i] = make_pair(id, counter.counts[id]);
+        counter.counts[id] = 0;
+    }
+    tf.entries = entries;
+    tf.size = static_cast<uint32_t>(counter.touched.size());
+    counter.touched.clear();
+
+    return totalWords;
+}
+
+// Function to add a document's terms to the document frequency (DF) counts; each term appears once per table
+void addDocumentFrequency(const TermTable& tf, vector<uint32_t>& df) {
+    for (const auto& entry : tf) {
+        df[entry.first]++;
+    }
+}
+
+// Function to calculate the term frequency (TF) of a term in a document of totalWords words
+double termFrequency(uint32_t count, uint32_t totalWords) {
+    return (static_cast<double>(count) / totalWords) * 100;
+}
 
-            // Add the document ID and content to the vector if docID is not empty
-            if (!docID.empty()) {
-                documents.emplace_back(docID, content);
+// Function to calculate the TF-IDF score for a document given the keyword term IDs
+double calculateTFIDFScore(const TermTable& tf, uint32_t totalWords, const vector<double>& idf, const vector<uint32_t>& keywordIds) {
+    double score = 0.0;
+    for (uint32_t id : keywordIds) {
+        if (id == NO_TERM) {
+            continue;
+        }
+        auto it = lower_bound(tf.begin(), tf.end(), make_pair(id, 0u));
+        if (it != tf.end() && it->first == id) {
+            score += termFrequency(it->second, totalWords) * idf[id];
+        }
+    }
+    return score;
+}
+
+/*
+The articles can be one file, a directory (every regular file below it) or a glob pattern whose matches may also be
+directories. The files are sorted by path, and documents are numbered in that order and then in file order, so the
+docIndex of a document never depends on which read finishes first.
+
+Every file is cut into pieces that are read straight into one buffer per file; the pieces are the
+unit of work from reading to scoring. A piece owns the documents that start in it: the first document of the file,
+and each one after a Form Feed (\x0C) inside the piece. A document that runs past the end of its piece is still in
+the same buffer, so it is never copied, and the piece only waits for the reads that hold the rest of it.
+*/
+struct ArticleFile {
+    string path;
+    uint64_t size = 0;
+    unique_ptr<char[]> data;            // Filled by the reads of its pieces
+};
+
+struct ArticlePiece {
+    uint32_t file = 0;
+    uint64_t offset = 0;
+    uint64_t length = 0;
+    size_t firstDoc = 0;                // Index of the piece's first document, once every piece is split
+    vector<pair<string_view, string_view>> documents;      // <docID, content>
+    vector<TermTable> tfDocs;
+    vector<uint32_t> docLengths;
+};
+
+const uint64_t MIN_PIECE = 64 << 10;   // Bytes per piece: about 16 pieces per thread, within these bounds
+const uint64_t MAX_PIECE = 4 << 20;
+
+// Function to add a path to the article files: a regular file itself, or every regular file below a directory
+bool addArticlePath(const string& path, vector<string>& paths) {
+    error_code error;
+    if (filesystem::is_directory(path, error)) {
+        for (filesystem::recursive_directory_iterator it(path, error), end; !error && it != end; it.increment(error)) {
+            if (it->is_regular_file(error)) {
+                paths.push_back(it->path().string());
             }
         }
+    } else if (filesystem::is_regular_file(path, error)) {
+        paths.push_back(path);
+    } else {
+        return false;
     }
+    return !error;
+}
+
+// Function to list the article files named by a file, a directory or a glob pattern, sorted by path
+bool listArticleFiles(const string& pattern, vector<ArticleFile>& files) {
+    vector<string> paths;
+    bool found;
+#ifndef _WIN32
+    if (pattern.find_first_of("*?[") != string::npos) {
+        glob_t matches;
+        found = glob(pattern.c_str(), 0, nullptr, &matches) == 0;
+        for (size_t i = 0; found && i < matches.gl_pathc; i++) {
+            found = addArticlePath(matches.gl_pathv[i], paths);
+        }
+        globfree(&matches);
+    } else
+#endif
+    {
+        found = addArticlePath(pattern, paths);
+    }
+    if (!found) {
+        cerr << "Unable to open file " << pattern << endl;
+        return false;
+    }
+
+    sort(paths.begin(), paths.end());
+    paths.erase(unique(paths.begin(), paths.end()), paths.end());
+    for (const string& path : paths) {
+        error_code error;
+        ArticleFile file;
+        file.path = path;
+        file.size = filesystem::file_size(path, error);
+        if (error) {
+            cerr << "Unable to open file " << path << endl;
+            return false;
+        }
+        files.push_back(move(file));
+    }
+    return true;
+}
 
-    return documents;
+// Function to cut the files into pieces of about totalBytes / (16 x threads) bytes and allocate their buffers
+vector<ArticlePiece> cutPieces(vector<ArticleFile>& files, int numThreads) {
+    uint64_t totalBytes = 0;
+    for (const auto& file : files) {
+        totalBytes += file.size;
+    }
+    uint64_t pieceSize = min(MAX_PIECE, max(MIN_PIECE, totalBytes / (static_cast<uint64_t>(numThreads) * 16)));
+
+    vector<ArticlePiece> pieces;
+    for (size_t f = 0; f < files.size(); f++) {
+        // Not value-initialized, so the first touch decides where its pages go: see touchPieces
+        files[f].data.reset(new char[files[f].size]);
+        for (uint64_t offset = 0; offset < files[f].size; offset += pieceSize) {
+            ArticlePiece piece;
+            piece.file = static_cast<uint32_t>(f);
+            piece.offset = offset;
+            piece.length = min(pieceSize, files[f].size - offset);
+            pieces.push_back(move(piece));
+        }
+    }
+    return pieces;
 }
 
 /*
-Using regular expressions to extract words and convert them to lowercase; then using the unordered_set
-for dictionary and stopwords to filter the words.
+The pieces are read asynchronously, with up to IO_DEPTH reads in flight, in the order the workers will need them.
+On Linux the reads go through io_uring when the kernel supports it: one thread keeps the submission queue full and
+reaps the completions. Otherwise IO_DEPTH threads each read one piece at a time with pread. Both open a file for
+each read, so the number of open files stays bounded however many files the corpus has. A worker that needs a
+piece waits until its read has completed.
 */
-// Function to preprocess text: convert to lowercase, remove non-alphabetic characters, and remove stopwords and non-dictionary words
-string preProcessText(const string& text, const unordered_set<string>& dictionary, const unordered_set<string>& stopwords) {
-    string cleanedText;
-    string word;
-    for (char c : text) {
-        if (isalpha(c)) {
-            word += tolower(c);
-        } else {
-            if (!word.empty()) {
-                if (dictionary.find(word) != dictionary.end() && stopwords.find(word) == stopwords.end()) {
-                    cleanedText += word + " ";
+const unsigned IO_DEPTH = 32;
+
+class PieceReader {
+public:
+    PieceReader(const vector<ArticleFile>& files, const vector<ArticlePiece>& pieces, const vector<size_t>& order, bool allowRing)
+        : files(files), pieces(pieces), order(order), status(pieces.size(), PENDING) {
+#ifdef SEARCH_IO_URING
+        if (allowRing && ring.setUp(IO_DEPTH)) {
+            method = "io_uring";
+            threads.emplace_back(&PieceReader::ringLoop, this);
+            return;
+        }
+#else
+        (void)allowRing;
+#endif
+        method = "threads";
+        for (unsigned t = 0; t < min<size_t>(IO_DEPTH, pieces.size()); t++) {
+            threads.emplace_back(&PieceReader::threadLoop, this);
+        }
+    }
+
+    ~PieceReader() {
+        for (auto& reader : threads) {
+            reader.join();
+        }
+    }
+
+    PieceReader(const PieceReader&) = delete;
+    PieceReader& operator=(const PieceReader&) = delete;
+
+    // Function to wait until a piece has been read; false if the read failed
+    bool wait(size_t piece) {
+        unique_lock<mutex> lock(statusMutex);
+        pieceRead.wait(lock, [&] { return status[piece] != PENDING; });
+        return status[piece] == DONE;
+    }
+
+    const string& ioMethod() const {
+        return method;
+    }
+
+private:
+    enum : char { PENDING, DONE, FAILED };
+
+    const vector<ArticleFile>& files;
+    const vector<ArticlePiece>& pieces;
+    vector<size_t> order;
+    atomic<size_t> nextRead{0};         // Position in order of the next piece to read
+    string method;
+    vector<thread> threads;
+
+    mutex statusMutex;
+    condition_variable pieceRead;
+    vector<char> status;
+
+    void finish(size_t piece, bool ok) {
+        if (!ok) {
+            cerr << "Unable to read file " << files[pieces[piece].file].path << endl;
+        }
+        lock_guard<mutex> lock(statusMutex);
+        status[piece] = ok ? DONE : FAILED;
+        pieceRead.notify_all();
+    }
+
+    char* destination(size_t piece) const {
+        return files[pieces[piece].file].data.get() + pieces[piece].offset;
+    }
+
+    // Thread function of the fallback: read the next piece with blocking reads until none is left
+    void threadLoop() {
+        for (size_t next; (next = nextRead++) < order.size();) {
+            size_t piece = order[next];
+            const ArticlePiece& target = pieces[piece];
+            bool ok = false;
+#ifndef _WIN32
+            int fd = open(files[target.file].path.c_str(), O_RDONLY);
+            uint64_t done = 0;
+            while (fd >= 0 && done < target.length) {
+                ssize_t count = pread(fd, destination(piece) + done, target.length - done, target.offset + done);
+                if (count <= 0) {
+                    break;
                 }
-                word.clear();
+                done += count;
             }
+            ok = fd >= 0 && done == target.length;
+            if (fd >= 0) {
+                close(fd);
+            }
+#else
+            ifstream in(files[target.file].path, ios::binary);
+            in.seekg(target.offset);
+            in.read(destination(piece), target.length);
+            ok = static_cast<uint64_t>(in.gcount()) == target.length;
+#endif
+            finish(piece, ok);
         }
     }
 
-    if (!word.empty() && dictionary.find(word) != dictionary.end() && stopwords.find(word) == stopwords.end()) {
-        cleanedText += word + " ";
+#ifdef SEARCH_IO_URING
+    /*
+    A minimal io_uring set up with the raw system calls: the submission and completion rings and the submission
+    entries are mapped from the ring's file descriptor, and the ring heads and tails are shared with the kernel.
+    */
+    struct Ring {
+        int fd = -1;
+        unsigned entries = 0;
+        void* sqMapping = MAP_FAILED;
+        void* cqMapping = MAP_FAILED;
+        void* sqeMapping = MAP_FAILED;
+        size_t sqSize = 0;
+        size_t cqSize = 0;
+        size_t sqeSize = 0;
+        unsigned* sqTail = nullptr;
+        unsigned* sqMask = nullptr;
+        unsigned* sqArray = nullptr;
+        io_uring_sqe* sqes = nullptr;
+        unsigned* cqHead = nullptr;
+        unsigned* cqTail = nullptr;
+        unsigned* cqMask = nullptr;
+        io_uring_cqe* cqes = nullptr;
+
+        ~Ring() {
+            if (sqeMapping != MAP_FAILED) {
+                munmap(sqeMapping, sqeSize);
+            }
+            if (cqMapping != MAP_FAILED && cqMapping != sqMapping) {
+                munmap(cqMapping, cqSize);
+            }
+            if (sqMapping != MAP_FAILED) {
+                munmap(sqMapping, sqSize);
+            }
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+
+        // Function to create the ring; false if io_uring or its read operation is not available
+        bool setUp(unsigned depth) {
+            io_uring_params params;
+            memset(&params, 0, sizeof(params));
+            fd = static_cast<int>(syscall(__NR_io_uring_setup, depth, &params));
+            if (fd < 0) {
+                return false;
+            }
+
+            // IORING_OP_READ needs Linux 5.6; ask the kernel rather than trusting the headers
+            vector<char> probeBuffer(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op), 0);
+            auto* probe = reinterpret_cast<io_uring_probe*>(probeBuffer.data());
+            if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) < 0 || probe->last_op < IORING_OP_READ ||
+                !(probe->ops[IORING_OP_READ].flags & IO_URING_OP_SUPPORTED)) {
+                return false;
+            }
+
+            entries = params.sq_entries;
+            sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if (params.features & IORING_FEAT_SINGLE_MMAP) {
+                sqSize = cqSize = max(sqSize, cqSize);
+            }
+            sqMapping = mmap(nullptr, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+            if (sqMapping == MAP_FAILED) {
+                return false;
+            }
+            cqMapping = (params.features & IORING_FEAT_SINGLE_MMAP) ? sqMapping
+                : mmap(nullptr, cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            sqeSize = params.sq_entries * sizeof(io_uring_sqe);
+            sqeMapping = mmap(nullptr, sqeSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+            if (cqMapping == MAP_FAILED || sqeMapping == MAP_FAILED) {
+                return false;
+            }
+
+            char* sq = static_cast<char*>(sqMapping);
+            char* cq = static_cast<char*>(cqMapping);
+            sqTail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+            sqMask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+            sqArray = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+            sqes = static_cast<io_uring_sqe*>(sqeMapping);
+            cqHead = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+            cqTail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+            cqMask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+            cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+            return true;
+        }
+    };
+
+    struct RingRead {
+        size_t piece = 0;
+        int fd = -1;
+        uint64_t done = 0;              // Bytes read so far; a short read is resubmitted for the rest
+    };
+
+    Ring ring;
+
+    // Function to queue the read of the rest of a piece; the caller submits the queue
+    void queueRead(const RingRead& read, unsigned slot, unsigned& tail) {
+        const ArticlePiece& target = pieces[read.piece];
+        io_uring_sqe& sqe = ring.sqes[tail & *ring.sqMask];
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READ;
+        sqe.fd = read.fd;
+        sqe.addr = reinterpret_cast<uint64_t>(destination(read.piece) + read.done);
+        sqe.len = static_cast<uint32_t>(target.length - read.done);
+        sqe.off = target.offset + read.done;
+        sqe.user_data = slot;
+        ring.sqArray[tail & *ring.sqMask] = tail & *ring.sqMask;
+        tail++;
     }
 
-    return cleanedText;
+    // Thread function of io_uring reading: keep up to the ring's depth of reads in flight until every piece is read
+    void ringLoop() {
+        vector<RingRead> slots(ring.entries);
+        vector<unsigned> freeSlots;
+        for (unsigned slot = 0; slot < ring.entries; slot++) {
+            freeSlots.push_back(slot);
+        }
+        unsigned tail = *ring.sqTail;
+        unsigned submitted = tail;
+
+        while (true) {
+            // Open and queue new reads while there is room in the ring
+            while (!freeSlots.empty() && nextRead < order.size()) {
+                RingRead read;
+                read.piece = order[nextRead++];
+                read.fd = open(files[pieces[read.piece].file].path.c_str(), O_RDONLY);
+                if (read.fd < 0) {
+                    finish(read.piece, false);
+                    continue;
+                }
+                unsigned slot = freeSlots.back();
+                freeSlots.pop_back();
+                slots[slot] = read;
+                queueRead(read, slot, tail);
+            }
+            if (freeSlots.size() == ring.entries && tail == submitted) {
+                break;
+            }
+
+            // Submit what was queued and wait for at least one completion
+            __atomic_store_n(ring.sqTail, tail, __ATOMIC_RELEASE);
+            long entered = syscall(__NR_io_uring_enter, ring.fd, tail - submitted, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (entered < 0 && errno != EINTR) {
+                break;
+            }
+            submitted += entered > 0 ? static_cast<unsigned>(entered) : 0;
+
+            unsigned head = *ring.cqHead;
+            unsigned completed = __atomic_load_n(ring.cqTail, __ATOMIC_ACQUIRE);
+            for (; head != completed; head++) {
+                const io_uring_cqe& cqe = ring.cqes[head & *ring.cqMask];
+                unsigned slot = static_cast<unsigned>(cqe.user_data);
+                RingRead& read = slots[slot];
+                if (cqe.res > 0) {
+                    read.done += cqe.res;
+                }
+                if (cqe.res > 0 && read.done < pieces[read.piece].length) {
+                    queueRead(read, slot, tail);
+                    continue;
+                }
+                close(read.fd);
+                finish(read.piece, read.done == pieces[read.piece].length);
+                freeSlots.push_back(slot);
+            }
+            __atomic_store_n(ring.cqHead, head, __ATOMIC_RELEASE);
+        }
+
+        // The ring failed: every read still in flight or not started yet counts as failed
+        for (unsigned slot = 0; slot < ring.entries; slot++) {
+            if (find(freeSlots.begin(), freeSlots.end(), slot) == freeSlots.end()) {
+                close(slots[slot].fd);
+                finish(slots[slot].piece, false);
+            }
+        }
+        for (size_t next; (next = nextRead++) < order.size();) {
+            finish(order[next], false);
+        }
+    }
+#endif
+};
+
+// Function to split one document into its ID (the first non-empty line) and content; false if it has no ID
+bool splitDocument(string_view document, string_view& docID, string_view& content) {
+    // Remove leading whitespace
+    size_t begin = 0;
+    while (begin < document.size() && isspace(static_cast<unsigned char>(document[begin]))) {
+        begin++;
+    }
+    document.remove_prefix(begin);
+
+    // The first line is the document ID, the remaining lines are the content
+    size_t lineEnd = document.find('\n');
+    docID = document.substr(0, lineEnd);
+    content = lineEnd == string_view::npos ? string_view() : document.substr(lineEnd + 1);
+    return !docID.empty();
 }
 
+// Function to find the Form Feed that ends the document at from, waiting for the reads of the pieces it runs into;
+// returns the end of the file if there is none, and sets ok to false if a read failed
+uint64_t findDocumentEnd(const vector<ArticleFile>& files, const vector<ArticlePiece>& pieces, PieceReader& reader, size_t piece, uint64_t from, bool& ok) {
+    const ArticleFile& file = files[pieces[piece].file];
+    while (true) {
+        uint64_t limit = pieces[piece].offset + pieces[piece].length;
+        if (from < limit) {
+            const void* formFeed = memchr(file.data.get() + from, '\x0C', limit - from);
+            if (formFeed != nullptr) {
+                return static_cast<const char*>(formFeed) - file.data.get();
+            }
+            from = limit;
+        }
+        if (limit >= file.size) {
+            return file.size;
+        }
+        if (!reader.wait(++piece)) {
+            ok = false;
+            return file.size;
+        }
+    }
+}
 
-// Function to calculate term frequency (TF) for each word in each
-unordered_map<string, double> calculateTF(const string& text) {
-    unordered_map<string, double> tf;
-    stringstream ss(text);
+// Function to read the CPU time used by the calling thread so far, in seconds (0 where it is not available)
+double threadCPUSeconds() {
+#ifndef _WIN32
+    timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+#else
+    return 0;
+#endif
+}
 
-    string word;
-    int totalWords = 0;
+/*
+With --numa the pool is laid out after the machine's NUMA topology, read from /sys/devices/system/node on Linux
+(elsewhere, or when it cannot be read, the machine counts as one node). Every node gets a share of the workers in
+proportion to the CPUs the process may use there, and each worker is pinned to one of its node's CPUs. Memory a
+thread touches first is placed on the node that thread runs on, so everything a pinned worker allocates and fills
+stays local to it.
+*/
+struct WorkerPlacement {
+    int node = 0;       // Operating system number of the NUMA node
+    int cpu = -1;       // CPU the worker is pinned to, -1 when it is not pinned
+};
 
-    while (ss >> word) {
-        tf[word]++;
-        totalWords++;
+// Function to parse a sysfs CPU list such as "0-3,8-11" into CPU numbers
+vector<int> parseCPUList(const string& text) {
+    vector<int> cpus;
+    size_t pos = 0;
+    while (pos < text.size()) {
+        size_t comma = text.find(',', pos);
+        string range = text.substr(pos, comma == string::npos ? string::npos : comma - pos);
+        size_t dash = range.find('-');
+        if (!range.empty() && isdigit(static_cast<unsigned char>(range[0]))) {
+            int first = stoi(range);
+            int last = dash == string::npos ? first : stoi(range.substr(dash + 1));
+            for (int cpu = first; cpu <= last; cpu++) {
+                cpus.push_back(cpu);
+            }
+        }
+        pos = comma == string::npos ? text.size() : comma + 1;
     }
+    return cpus;
+}
 
-    // Calculate term frequency (TF)
-    
-    for (auto& pair : tf) {
-        pair.second = (pair.second/totalWords) * 100;
+// Function to read the NUMA nodes and the CPUs of each that this process may run on; nodes without such CPUs are left out
+vector<pair<int, vector<int>>> readNumaTopology() {
+    vector<pair<int, vector<int>>> nodes;     // <node, CPUs>
+#ifdef __linux__
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool haveAffinity = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    if (DIR* dir = opendir("/sys/devices/system/node")) {
+        while (dirent* entry = readdir(dir)) {
+            if (strncmp(entry->d_name, "node", 4) != 0 || !isdigit(static_cast<unsigned char>(entry->d_name[4]))) {
+                continue;
+            }
+            ifstream file(string("/sys/devices/system/node/") + entry->d_name + "/cpulist");
+            string list;
+            getline(file, list);
+            vector<int> cpus;
+            for (int cpu : parseCPUList(list)) {
+                if (!haveAffinity || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))) {
+                    cpus.push_back(cpu);
+                }
+            }
+            if (!cpus.empty()) {
+                nodes.emplace_back(atoi(entry->d_name + 4), cpus);
+            }
+        }
+        closedir(dir);
     }
-    
-    return tf;
+    sort(nodes.begin(), nodes.end());
+    if (nodes.empty() && haveAffinity) {
+        nodes.emplace_back(0, vector<int>());
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                nodes[0].second.push_back(cpu);
+            }
+        }
+    }
+#endif
+    if (nodes.empty()) {
+        nodes.emplace_back(0, vector<int>());
+    }
+    return nodes;
+}
+
+// Function to place numThreads workers on the nodes: consecutive workers share a node, each pinned to one of its CPUs
+vector<WorkerPlacement> placeWorkers(const vector<pair<int, vector<int>>>& nodes, int numThreads) {
+    size_t totalCPUs = 0;
+    for (const auto& node : nodes) {
+        totalCPUs += max<size_t>(1, node.second.size());
+    }
+    vector<WorkerPlacement> placements;
+    size_t cpusBefore = 0;
+    for (const auto& node : nodes) {
+        size_t first = numThreads * cpusBefore / totalCPUs;
+        cpusBefore += max<size_t>(1, node.second.size());
+        size_t last = numThreads * cpusBefore / totalCPUs;
+        for (size_t w = first; w < last; w++) {
+            WorkerPlacement placement;
+            placement.node = node.first;
+            placement.cpu = node.second.empty() ? -1 : node.second[(w - first) % node.second.size()];
+            placements.push_back(placement);
+        }
+    }
+    return placements;
+}
+
+// Function to pin the calling thread to one CPU; false if that is not possible
+bool pinThread(int cpu) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+// Function to return the CPU the calling thread runs on, -1 where it is not known
+int currentCPU() {
+#ifdef __linux__
+    return sched_getcpu();
+#else
+    return -1;
+#endif
 }
 
-// Function to calculate inverse document frequency (IDF) for each word
-unordered_map<string, double> calculateIDF(const vector<pair<string, string>>& documents) {
-    unordered_map<string, int> df;
-    unordered_map<string, double> idf;
-    int totalDocuments = documents.size();
+/*
+A fixed set of worker threads is started once and reused by every phase. A phase is a parallel loop over
+[0, count) cut into chunks. The chunks are dealt out in contiguous runs to per-worker queues; a worker takes
+chunks from the front of its own queue and, once it runs dry, steals from the back of the other queues. Document
+sizes vary by orders of magnitude, so this keeps every thread busy until the whole phase is done.
 
-    // Calculate document frequency (DF)
-    for (const auto& doc : documents) {
-        unordered_set<string> uniqueWords;
-        stringstream ss(doc.second);
-        string word;
+Workers on the same node are numbered consecutively, so every node is dealt one contiguous range of [0, count),
+in proportion to its workers, and a worker only steals from workers on its own node. Two phases over the same count
+and chunk size therefore run every element on the same node: the node that preprocessed a document also scores it.
+*/
+class ThreadPool {
+public:
+    // Timing of one parallelFor call: wall time, and per worker the time spent running chunks, its CPU time, the
+    // elements it ran, when it ran out of work and the CPU it was on at that point
+    struct PhaseStats {
+        double wallSeconds = 0;
+        vector<double> busySeconds;
+        vector<double> cpuSeconds;
+        vector<size_t> chunks;
+        vector<size_t> items;
+        vector<double> finishSeconds;
+        vector<int> cpus;
+        vector<int> nodes;                  // Node of every worker
+        size_t steals = 0;
+    };
 
-        while (ss >> word) {
-            uniqueWords.insert(word);
+    explicit ThreadPool(int numThreads) : ThreadPool(vector<WorkerPlacement>(numThreads)) {
+    }
+
+    explicit ThreadPool(const vector<WorkerPlacement>& placements)
+        : placements(placements), queues(placements.size()), busySeconds(placements.size()), cpuSeconds(placements.size()),
+          chunksRun(placements.size()), itemsRun(placements.size()), finishSeconds(placements.size()), lastCPU(placements.size(), -1) {
+        for (size_t w = 0; w < placements.size(); ++w) {
+            if (w == 0 || placements[w].node != placements[w - 1].node) {
+                nodeFirstWorker.push_back(static_cast<int>(w));
+            }
+            nodeIndex.push_back(static_cast<int>(nodeFirstWorker.size()) - 1);
+        }
+        nodeFirstWorker.push_back(static_cast<int>(placements.size()));
+        for (size_t w = 0; w < placements.size(); ++w) {
+            workers.emplace_back(&ThreadPool::workerLoop, this, static_cast<int>(w));
         }
+    }
 
-        for (const auto& word : uniqueWords) {
-            df[word]++;
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> lock(stateMutex);
+            stopping = true;
+        }
+        wakeUp.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
         }
     }
 
-    // Calculate inverse document frequency (IDF)
-    for (const auto& pair : df) {
-        idf[pair.first] = log10(static_cast<double>(totalDocuments) / pair.second);
+    int size() const {
+        return static_cast<int>(workers.size());
+    }
+
+    // Nodes are numbered 0 to nodeCount() - 1 here, in worker order; placement(worker).node is the system's number
+    int nodeCount() const {
+        return static_cast<int>(nodeFirstWorker.size()) - 1;
+    }
+
+    int nodeOf(int worker) const {
+        return nodeIndex[worker];
     }
 
-    return idf;
+    const WorkerPlacement& placement(int worker) const {
+        return placements[worker];
+    }
+
+    // Function to list [0, count) in the order parallelFor reaches the elements when all workers keep the same pace:
+    // the first chunk of every worker's run, then the second one, and so on
+    vector<size_t> scheduleOrder(size_t count, size_t chunkSize) const {
+        size_t numChunks = (count + chunkSize - 1) / chunkSize;
+        size_t numWorkers = workers.size();
+        vector<size_t> order;
+        for (size_t step = 0; order.size() < count; step++) {
+            for (size_t w = 0; w < numWorkers; w++) {
+                size_t chunk = numChunks * w / numWorkers + step;
+                if (chunk < numChunks * (w + 1) / numWorkers) {
+                    for (size_t i = chunk * chunkSize; i < min(count, (chunk + 1) * chunkSize); i++) {
+                        order.push_back(i);
+                    }
+                }
+            }
+        }
+        return order;
+    }
+
+    // Function to run body(begin, end, worker) over [0, count) in chunks of chunkSize and wait for all of them
+    PhaseStats parallelFor(size_t count, size_t chunkSize, const function<void(size_t, size_t, int)>& body) {
+        return runPhase(count, chunkSize, body, true);
+    }
+
+    // Function to run body(worker) once on every worker, each on its own thread, for example to allocate memory there
+    PhaseStats onEachWorker(const function<void(int)>& body) {
+        return runPhase(workers.size(), 1, [&body](size_t, size_t, int worker) { body(worker); }, false);
+    }
+
+private:
+    struct WorkQueue {
+        mutex lock;
+        deque<pair<size_t, size_t>> chunks;     // <begin, end> ranges still to run
+    };
+
+    vector<WorkerPlacement> placements;
+    vector<int> nodeIndex;                      // worker -> node (0-based, in worker order)
+    vector<int> nodeFirstWorker;                // node -> its first worker, with the worker count at the end
+    vector<thread> workers;
+    vector<WorkQueue> queues;
+    vector<double> busySeconds;                 // Written only by the owning worker during a phase
+    vector<double> cpuSeconds;
+    vector<size_t> chunksRun;
+    vector<size_t> itemsRun;
+    vector<double> finishSeconds;
+    vector<int> lastCPU;
+    atomic<size_t> steals{0};
+    bool stealing = true;
+    high_resolution_clock::time_point phaseStart;
+
+    mutex stateMutex;
+    condition_variable wakeUp;
+    condition_variable phaseDone;
+    const function<void(size_t, size_t, int)>* currentBody = nullptr;
+    uint64_t generation = 0;
+    int activeWorkers = 0;
+    bool stopping = false;
+
+    PhaseStats runPhase(size_t count, size_t chunkSize, const function<void(size_t, size_t, int)>& body, bool allowStealing) {
+        auto start = high_resolution_clock::now();
+        int numWorkers = size();
+        size_t numChunks = (count + chunkSize - 1) / chunkSize;
+
+        // Deal contiguous runs of chunks to the workers so neighbouring documents stay on the same thread
+        for (int w = 0; w < numWorkers; ++w) {
+            size_t first = numChunks * w / numWorkers;
+            size_t last = numChunks * (w + 1) / numWorkers;
+            lock_guard<mutex> lock(queues[w].lock);
+            for (size_t c = first; c < last; ++c) {
+                queues[w].chunks.emplace_back(c * chunkSize, min(count, (c + 1) * chunkSize));
+            }
+            busySeconds[w] = 0;
+            cpuSeconds[w] = 0;
+            chunksRun[w] = 0;
+            itemsRun[w] = 0;
+            finishSeconds[w] = 0;
+        }
+        steals = 0;
+
+        {
+            lock_guard<mutex> lock(stateMutex);
+            currentBody = &body;
+            stealing = allowStealing;
+            phaseStart = start;
+            activeWorkers = numWorkers;
+            generation++;
+        }
+        wakeUp.notify_all();
+
+        // Every worker checks in once it finds no chunk left anywhere, so none can still be using body afterwards
+        {
+            unique_lock<mutex> lock(stateMutex);
+            phaseDone.wait(lock, [this] { return activeWorkers == 0; });
+            currentBody = nullptr;
+        }
+
+        PhaseStats stats;
+        stats.wallSeconds = duration<double>(high_resolution_clock::now() - start).count();
+        stats.busySeconds = busySeconds;
+        stats.cpuSeconds = cpuSeconds;
+        stats.chunks = chunksRun;
+        stats.items = itemsRun;
+        stats.finishSeconds = finishSeconds;
+        stats.cpus = lastCPU;
+        for (const auto& placement : placements) {
+            stats.nodes.push_back(placement.node);
+        }
+        stats.steals = steals;
+        return stats;
+    }
+
+    // Function to take the next chunk: first from the worker's own queue, otherwise stolen from another one on its node
+    bool takeChunk(int worker, bool allowStealing, pair<size_t, size_t>& range) {
+        {
+            lock_guard<mutex> lock(queues[worker].lock);
+            if (!queues[worker].chunks.empty()) {
+                range = queues[worker].chunks.front();
+                queues[worker].chunks.pop_front();
+                return true;
+            }
+        }
+        if (!allowStealing) {
+            return false;
+        }
+        int firstWorker = nodeFirstWorker[nodeIndex[worker]];
+        int nodeWorkers = nodeFirstWorker[nodeIndex[worker] + 1] - firstWorker;
+        for (int k = 1; k < nodeWorkers; ++k) {
+            WorkQueue& victim = queues[firstWorker + (worker - firstWorker + k) % nodeWorkers];
+            lock_guard<mutex> lock(victim.lock);
+            if (!victim.chunks.empty()) {
+                range = victim.chunks.back();
+                victim.chunks.pop_back();
+                steals++;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(int worker) {
+        // Pin before the worker touches any memory, so everything it allocates lands on its node
+        if (placements[worker].cpu >= 0 && !pinThread(placements[worker].cpu)) {
+            cerr << "Unable to pin worker " << worker << " to CPU " << placements[worker].cpu << endl;
+        }
+
+        uint64_t seenGeneration = 0;
+        while (true) {
+            const function<void(size_t, size_t, int)>* body;
+            bool allowStealing;
+            high_resolution_clock::time_point start;
+            {
+                unique_lock<mutex> lock(stateMutex);
+                wakeUp.wait(lock, [&] { return stopping || generation != seenGeneration; });
+                if (stopping) {
+                    return;
+                }
+                seenGeneration = generation;
+                body = currentBody;
+                allowStealing = stealing;
+                start = phaseStart;
+            }
+
+            pair<size_t, size_t> range;
+            double cpuStart = threadCPUSeconds();
+            while (takeChunk(worker, allowStealing, range)) {
+                auto chunkStart = high_resolution_clock::now();
+                (*body)(range.first, range.second, worker);
+                busySeconds[worker] += duration<double>(high_resolution_clock::now() - chunkStart).count();
+                chunksRun[worker]++;
+                itemsRun[worker] += range.second - range.first;
+            }
+            cpuSeconds[worker] = threadCPUSeconds() - cpuStart;
+            finishSeconds[worker] = duration<double>(high_resolution_clock::now() - start).count();
+            lastCPU[worker] = currentCPU();
+
+            lock_guard<mutex> lock(stateMutex);
+            if (--activeWorkers == 0) {
+                phaseDone.notify_one();
+            }
+        }
+    }
+};
+
+// Function to pick the chunk size of a phase: small enough to balance the load, large enough to keep queue traffic low
+size_t chunkSizeFor(size_t count, int numThreads) {
+    return max<size_t>(1, count / (static_cast<size_t>(numThreads) * 16));
 }
 
-// Function to calculate the TF-IDF score for a document given the keywords
-double calculateTFIDFScore(const unordered_map<string, double>& tf, const unordered_map<string, double>& idf, const vector<string>& keywords) {
-    double score = 0.0;
-    for (const auto& keyword : keywords) {
-        if (tf.find(keyword) != tf.end() && idf.find(keyword) != idf.end()) {
-            score += tf.at(keyword) * idf.at(keyword);
+// Function to print the utilization of a phase: busy time of all workers relative to threads x wall time, and with
+// perNode the throughput of every node: the elements its workers ran over the time until the last of them finished
+void reportPhase(const string& name, const ThreadPool::PhaseStats& stats, bool perNode) {
+    double busy = 0;
+    for (double seconds : stats.busySeconds) {
+        busy += seconds;
+    }
+    double utilization = stats.wallSeconds > 0 ? busy / (stats.wallSeconds * stats.busySeconds.size()) * 100 : 100;
+    cout << "  " << left << setw(12) << name << right << fixed << setprecision(2) << setw(9) << stats.wallSeconds * 1000
+         << " ms  utilization " << setw(6) << utilization << "%  steals " << stats.steals << "  chunks/thread";
+    for (size_t chunks : stats.chunks) {
+        cout << " " << chunks;
+    }
+    cout << endl;
+
+    for (size_t first = 0, last; perNode && first < stats.nodes.size(); first = last) {
+        size_t items = 0;
+        double seconds = 0;
+        for (last = first; last < stats.nodes.size() && stats.nodes[last] == stats.nodes[first]; last++) {
+            items += stats.items[last];
+            seconds = max(seconds, stats.finishSeconds[last]);
         }
+        cout << "    node " << stats.nodes[first] << ": " << last - first << " workers, " << items << " items in "
+             << setprecision(2) << seconds * 1000 << " ms, " << setprecision(0) << (seconds > 0 ? items / seconds : 0) << " items/s" << endl;
     }
-    return score;
 }
 
-// Thread function to calculate TF for a batch of documents
-void preprocessParallel(vector<pair<string, string>>& documents, vector<pair<string, string>>& preprocessedDocuments, const unordered_set<string>& dictionary, const unordered_set<string>& stopwords, int start, int end) {
-    for (int i = start; i < end; ++i) {
-        string cleanedContent = preProcessText(documents[i].second, dictionary, stopwords);
-        preprocessedDocuments[i] = make_pair(documents[i].first, cleanedContent);
+/*
+Every stage of a run is measured: wall time, CPU time of the process (all threads), the bytes, documents and tokens
+(words kept by preprocessing) it handled, and the peak resident set size when it ended. The peak is the high-water
+mark of the whole run so far, so it never decreases from one stage to the next. Stages run on the pool also keep
+the pool's per-worker busy time, CPU time and chunk counts. With --profile the measurements are written as JSON, so
+runs over different corpus sizes and thread counts can be compared stage by stage.
+*/
+struct StageProfile {
+    string name;
+    double wallSeconds = 0;
+    double cpuSeconds = 0;
+    uint64_t bytes = 0;
+    uint64_t documents = 0;
+    uint64_t tokens = 0;
+    long peakRSSKilobytes = 0;
+    bool parallel = false;
+    ThreadPool::PhaseStats phase;           // Per-worker breakdown, for stages run on the pool
+};
+
+struct Profiler {
+    vector<StageProfile> stages;
+    high_resolution_clock::time_point stageStart;
+    double stageCPUStart = 0;
+};
+
+// Function to read the CPU time used by all threads of the process so far, in seconds
+double processCPUSeconds() {
+#ifndef _WIN32
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+#else
+    return static_cast<double>(clock()) / CLOCKS_PER_SEC;
+#endif
+}
+
+// Function to read the peak resident set size of the process so far, in kilobytes (0 where it is not available)
+long peakRSSKilobytes() {
+#if defined(_WIN32)
+    return 0;
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;      // macOS reports bytes
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+// Function to find the size of a file in bytes, 0 if it cannot be opened
+uint64_t fileSize(const string& filename) {
+    ifstream file(filename, ios::binary | ios::ate);
+    return file.is_open() ? static_cast<uint64_t>(file.tellg()) : 0;
+}
+
+// Function to start measuring the next stage
+void beginStage(Profiler& profiler) {
+    profiler.stageStart = high_resolution_clock::now();
+    profiler.stageCPUStart = processCPUSeconds();
+}
+
+// Function to record the stage started by the last beginStage
+StageProfile& endStage(Profiler& profiler, const string& name, uint64_t bytes, uint64_t documents, uint64_t tokens) {
+    StageProfile stage;
+    stage.name = name;
+    stage.wallSeconds = duration<double>(high_resolution_clock::now() - profiler.stageStart).count();
+    stage.cpuSeconds = processCPUSeconds() - profiler.stageCPUStart;
+    stage.bytes = bytes;
+    stage.documents = documents;
+    stage.tokens = tokens;
+    stage.peakRSSKilobytes = peakRSSKilobytes();
+    profiler.stages.push_back(stage);
+    return profiler.stages.back();
+}
+
+// Function to record a stage that ran on the pool, with the per-worker breakdown of its phase
+void endStage(Profiler& profiler, const string& name, uint64_t bytes, uint64_t documents, uint64_t tokens, const ThreadPool::PhaseStats& phase) {
+    StageProfile& stage = endStage(profiler, name, bytes, documents, tokens);
+    stage.parallel = true;
+    stage.phase = phase;
+}
+
+// Function to write text as a JSON string literal
+void writeJSONString(ostream& out, const string& text) {
+    out << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out << "\\u" << hex << setw(4) << setfill('0') << static_cast<int>(c) << dec << setfill(' ');
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+// Function to write the stages of a run as JSON
+bool writeProfile(const Profiler& profiler, const string& filename, int numThreads, bool numa, const vector<string>& keywords) {
+    ofstream out(filename);
+    if (!out.is_open()) {
+        cerr << "Unable to open file " << filename << endl;
+        return false;
+    }
+
+    double totalWall = 0;
+    double totalCPU = 0;
+    for (const auto& stage : profiler.stages) {
+        totalWall += stage.wallSeconds;
+        totalCPU += stage.cpuSeconds;
+    }
+
+    out << fixed << setprecision(6);
+    out << "{\n  \"program\": \"search-p\",\n  \"mode\": \"query\",\n  \"threads\": " << numThreads << ",\n  \"numa\": " << (numa ? "true" : "false") << ",\n  \"keywords\": [";
+    for (size_t i = 0; i < keywords.size(); i++) {
+        out << (i > 0 ? ", " : "");
+        writeJSONString(out, keywords[i]);
+    }
+    out << "],\n  \"wallSeconds\": " << totalWall << ",\n  \"cpuSeconds\": " << totalCPU
+        << ",\n  \"peakRSSKilobytes\": " << peakRSSKilobytes() << ",\n  \"stages\": [";
+    for (size_t i = 0; i < profiler.stages.size(); i++) {
+        const StageProfile& stage = profiler.stages[i];
+        double seconds = stage.wallSeconds > 0 ? stage.wallSeconds : 1e-9;
+        out << (i > 0 ? "," : "") << "\n    {\"name\": ";
+        writeJSONString(out, stage.name);
+        out << ", \"wallSeconds\": " << stage.wallSeconds << ", \"cpuSeconds\": " << stage.cpuSeconds
+            << ", \"bytes\": " << stage.bytes << ", \"documents\": " << stage.documents << ", \"tokens\": " << stage.tokens
+            << ", \"bytesPerSecond\": " << stage.bytes / seconds << ", \"documentsPerSecond\": " << stage.documents / seconds
+            << ", \"tokensPerSecond\": " << stage.tokens / seconds << ", \"peakRSSKilobytes\": " << stage.peakRSSKilobytes;
+        if (stage.parallel) {
+            out << ",\n     \"steals\": " << stage.phase.steals << ", \"workers\": [";
+            for (size_t w = 0; w < stage.phase.busySeconds.size(); w++) {
+                out << (w > 0 ? ", " : "") << "\n       {\"worker\": " << w << ", \"busySeconds\": " << stage.phase.busySeconds[w]
+                    << ", \"cpuSeconds\": " << stage.phase.cpuSeconds[w] << ", \"chunks\": " << stage.phase.chunks[w]
+                    << ", \"items\": " << stage.phase.items[w] << ", \"finishSeconds\": " << stage.phase.finishSeconds[w]
+                    << ", \"node\": " << stage.phase.nodes[w] << ", \"cpu\": " << stage.phase.cpus[w] << "}";
+            }
+            out << "]";
+        }
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+    return static_cast<bool>(out);
+}
+
+// Function to parse a positive thread count, returning 0 if the text is not one
+int parseThreadCount(const char* text) {
+    char* end;
+    long value = strtol(text, &end, 10);
+    return (*text != '\0' && *end == '\0' && value > 0 && value <= 4096) ? static_cast<int>(value) : 0;
+}
+
+/*
+Only the best NUM documents are ever printed, so instead of sorting every score the results are selected with a
+bounded heap of K entries: O(N log K), and no docID string is built for a document that does not make the cut.
+The heap keeps the lowest ranked of the current top K at its front, ready to be replaced. Every worker fills its own
+heap and the heaps are merged once scoring is done.
+*/
+// Ranking order: TF-IDF score descending; if the Sim value is the same, ascending by web page number (docIndex)
+bool ranksBefore(const pair<double, int>& a, const pair<double, int>& b) {
+    return a.first == b.first ? a.second < b.second : a.first > b.first;
+}
+
+struct TopK {
+    size_t k;
+    vector<pair<double, int>> heap;     // <score, docIndex>
+
+    explicit TopK(size_t k) : k(k) {
+        heap.reserve(min<size_t>(k, 1 << 16));
+    }
+
+    // Function to offer a document to the selection
+    void push(double score, int docIndex) {
+        pair<double, int> entry(score, docIndex);
+        if (heap.size() < k) {
+            heap.push_back(entry);
+            push_heap(heap.begin(), heap.end(), ranksBefore);
+        } else if (k > 0 && ranksBefore(entry, heap.front())) {
+            pop_heap(heap.begin(), heap.end(), ranksBefore);
+            heap.back() = entry;
+            push_heap(heap.begin(), heap.end(), ranksBefore);
+        }
+    }
+
+    // Function to fold another selection (for example a worker's) into this one
+    void merge(const TopK& other) {
+        for (const auto& entry : other.heap) {
+            push(entry.first, entry.second);
+        }
+    }
+
+    // Function to return the selected documents, best first
+    vector<pair<double, int>> sorted() const {
+        vector<pair<double, int>> ranked(heap);
+        sort(ranked.begin(), ranked.end(), ranksBefore);
+        return ranked;
+    }
+};
+
+/*
+The reads run on the io_uring kernel path or on unpinned reader threads, so the pages they touch first could land on
+any node. With --numa the workers therefore fault in the pages of their pieces before any read starts, writing one
+byte per page; the pieces are dealt exactly as in preprocessing, so each piece's text is placed on the node that
+splits, preprocesses and scores it. Only a page that a piece boundary falls in is shared with the neighbouring piece.
+*/
+// Thread function to fault in the buffer pages of a batch of pieces on the calling worker's node
+void touchPieces(vector<ArticleFile>& files, const vector<ArticlePiece>& pieces, size_t start, size_t end) {
+    const size_t pageSize = 4096;
+    for (size_t p = start; p < end; ++p) {
+        char* data = files[pieces[p].file].data.get();
+        for (uint64_t offset = pieces[p].offset; offset < pieces[p].offset + pieces[p].length; offset += pageSize) {
+            data[offset] = 0;
+        }
+    }
+}
+
+/*
+A piece is split and preprocessed by the worker that runs it, as soon as its read completes, so reading, splitting
+and preprocessing overlap. Its document list, TF tables and lengths are allocated by that worker, and the TF tables
+come from the worker's arena, so with --numa they are first touched (and placed) on the worker's node, like the
+piece's text. Scoring deals the pieces the same way, so a node only ever reads the pieces it preprocessed.
+*/
+// Thread function to split a batch of pieces into documents, count their terms (TF) and the batch's document frequency (DF)
+bool preprocessParallel(const vector<ArticleFile>& files, vector<ArticlePiece>& pieces, PieceReader& reader, TermCounter& counter, pmr::monotonic_buffer_resource& arena, vector<uint32_t>& localDF, const TermFilter& filter, size_t start, size_t end) {
+    bool ok = true;
+    for (size_t p = start; p < end && ok; ++p) {
+        ArticlePiece& piece = pieces[p];
+        const char* data = files[piece.file].data.get();
+        if (!reader.wait(p)) {
+            return false;
+        }
+
+        // The piece's first document starts at the beginning of the file or after its first Form Feed
+        uint64_t pieceEnd = piece.offset + piece.length;
+        uint64_t docStart = piece.offset;
+        if (piece.offset > 0) {
+            const void* formFeed = memchr(data + piece.offset, '\x0C', piece.length);
+            if (formFeed == nullptr) {
+                continue;
+            }
+            docStart = static_cast<const char*>(formFeed) - data + 1;
+        }
+        while (ok) {
+            uint64_t docEnd = findDocumentEnd(files, pieces, reader, p, docStart, ok);
+            string_view docID;
+            string_view content;
+            if (ok && splitDocument(string_view(data + docStart, docEnd - docStart), docID, content)) {
+                piece.documents.emplace_back(docID, content);
+                piece.tfDocs.emplace_back();
+                piece.docLengths.push_back(preProcessText(content, filter, counter, arena, piece.tfDocs.back()));
+                addDocumentFrequency(piece.tfDocs.back(), localDF);
+            }
+            // The next document belongs to this piece only if the Form Feed ending this one lies inside it
+            if (docEnd >= pieceEnd) {
+                break;
+            }
+            docStart = docEnd + 1;
+        }
     }
+    return ok;
 }
 
-// Thread function to calculate TF for a batch of documents
-void calculateTFParallel(vector<unordered_map<string, double>>& tfDocs, const vector<pair<string, string>>& preprocessedDocuments, int start, int end) {
-    for (int i = start; i < end; ++i) {
-        tfDocs[i] = calculateTF(preprocessedDocuments[i].second);
+/*
+Every worker keeps its own DF table while preprocessing, so no lock is needed. The tables are then merged in
+parallel, each chunk summing one range of term IDs across all of them (a shard of the vocabulary), and the IDF of
+that range is computed right away.
+*/
+// Thread function to merge the per-thread DF tables and compute the IDF for the term IDs in [start, end)
+void calculateIDFParallel(vector<double>& idf, const vector<vector<uint32_t>>& localDFs, size_t totalDocuments, size_t start, size_t end) {
+    for (size_t id = start; id < end; ++id) {
+        uint32_t df = 0;
+        for (const auto& localDF : localDFs) {
+            df += localDF[id];
+        }
+        // Terms that never occur are never scored
+        idf[id] = df > 0 ? log10(static_cast<double>(totalDocuments) / df) : 0.0;
     }
 }
 
-// Thread function to calculate TF-IDF scores for a batch of documents
-void calculateTFIDFScoreParallel(vector<pair<double, pair<int, string>>>& scores, const vector<unordered_map<string, double>>& tfDocs, const unordered_map<string, double>& idf, const vector<string>& keywords, const vector<pair<string, string>>& preprocessedDocuments, int start, int end) {
-    for (int i = start; i < end; ++i) {
-        double score = calculateTFIDFScore(tfDocs[i], idf, keywords);
-        if (score > 0) {
-            scores[i] = make_pair(score, make_pair(i + 1, preprocessedDocuments[i].first));
+// Thread function to calculate TF-IDF scores for the documents of a batch of pieces and offer the matching ones to the worker's top K
+void calculateTFIDFScoreParallel(TopK& top, const vector<ArticlePiece>& pieces, const vector<double>& idf, const vector<uint32_t>& keywordIds, size_t start, size_t end) {
+    for (size_t p = start; p < end; ++p) {
+        const ArticlePiece& piece = pieces[p];
+        for (size_t i = 0; i < piece.tfDocs.size(); ++i) {
+            double score = calculateTFIDFScore(piece.tfDocs[i], piece.docLengths[i], idf, keywordIds);
+            if (score > 0) {
+                top.push(score, static_cast<int>(piece.firstDoc + i) + 1);
+            }
         }
     }
 }
 
+// Function to find the ID of a document by its docIndex (1-based)
+string_view documentID(const vector<ArticlePiece>& pieces, size_t docIndex) {
+    auto it = upper_bound(pieces.begin(), pieces.end(), docIndex - 1, [](size_t index, const ArticlePiece& piece) {
+        return index < piece.firstDoc;
+    });
+    // The last piece starting at or before the document holds it: pieces without documents share the next one's firstDoc
+    return (it - 1)->documents[docIndex - 1 - (it - 1)->firstDoc].first;
+}
+
 int main(int argc, char* argv[]) {
-    if (argc < 3) {
-        cerr << "Usage: " << argv[0] << " NUM keyword1 keyword2 ... keywordN" << endl;
+    // Number of threads: --threads N, else SEARCH_THREADS, else half the number of available threads if not zero else 1
+    int numThreads = (thread::hardware_concurrency() / 2 != 0) ? thread::hardware_concurrency() / 2 : 1;
+    if (const char* env = getenv("SEARCH_THREADS")) {
+        if (parseThreadCount(env) > 0) {
+            numThreads = parseThreadCount(env);
+        } else {
+            cerr << "Ignoring invalid SEARCH_THREADS=" << env << endl;
+        }
+    }
+
+    // Options come before the query
+    string profileFile;
+    bool numa = false;
+    string articleFile = "data/article.txt";
+    bool allowRing = true;
+    int argStart = 1;
+    while (argStart < argc && strncmp(argv[argStart], "--", 2) == 0) {
+        string option = argv[argStart++];
+        if (option == "--threads") {
+            if (argStart >= argc || parseThreadCount(argv[argStart]) == 0) {
+                cerr << "--threads needs a positive number" << endl;
+                return 1;
+            }
+            numThreads = parseThreadCount(argv[argStart++]);
+        } else if (option == "--profile") {
+            // The profile path is optional; a numeric argument is the start of the query
+            bool hasPath = argStart < argc && strncmp(argv[argStart], "--", 2) != 0 && !isdigit(static_cast<unsigned char>(argv[argStart][0]));
+            profileFile = hasPath ? argv[argStart++] : "profile.json";
+        } else if (option == "--numa") {
+            numa = true;
+        } else if (option == "--articles" && argStart < argc) {
+            articleFile = argv[argStart++];
+        } else if (option == "--io" && argStart < argc && (strcmp(argv[argStart], "uring") == 0 || strcmp(argv[argStart], "threads") == 0)) {
+            allowRing = strcmp(argv[argStart++], "uring") == 0;
+        } else {
+            argStart = argc;
+        }
+    }
+
+    if (argc < argStart + 2) {
+        cerr << "Usage: " << argv[0] << " [--threads N] [--numa] [--articles FILE|DIR|PATTERN] [--io uring|threads] [--profile [FILE]] NUM keyword1 keyword2 ... keywordN" << endl;
         return 1;
     }
 
-    int numResults = stoi(argv[1]);
+    int numResults = stoi(argv[argStart]);
     vector<string> keywords;
-    for (int i = 2; i < argc; ++i) {
+    for (int i = argStart + 1; i < argc; ++i) {
         keywords.push_back(argv[i]);
     }
 
     string dictionaryFile = "data/dictionary.txt";
     string stopwordsFile = "data/stopwords.txt";
-    string articleFile = "data/article.txt";
 
     // Read dictionary and stopwords
+    Profiler profiler;
+    beginStage(profiler);
     unordered_set<string> dictionary = readWords(dictionaryFile);
+    endStage(profiler, "load dictionary", fileSize(dictionaryFile), 0, dictionary.size());
+    beginStage(profiler);
     unordered_set<string> stopwords = readWords(stopwordsFile);
+    endStage(profiler, "load stopwords", fileSize(stopwordsFile), 0, stopwords.size());
     cout << "Dictionary contains " << dictionary.size() << " words." << endl;
     cout << "Stopwords contains " << stopwords.size() << " words." << endl;
 
-    // Read and parse articles
-    vector<pair<string, string>> documents = readArticles(articleFile);
-    cout << "Processed " << documents.size() << " documents." << endl;
-
-    // Number of threads equal to half the number of available threads if not zero else 1
-    int numThreads = (thread::hardware_concurrency() / 2 != 0) ? thread::hardware_concurrency() / 2 : 1;
+    // One pool serves every phase; with --numa its workers are spread over the NUMA nodes and pinned
+    ThreadPool pool(numa ? placeWorkers(readNumaTopology(), numThreads) : vector<WorkerPlacement>(numThreads));
     cout << "Number of threads: " << numThreads << endl;
-
-    auto start = high_resolution_clock::now(); // Start timing
-
-    // Preprocess each document
-    vector<pair<string, string>> preprocessedDocuments(documents.size());
-    vector<thread> preProcessingThreads;
-
-    int batchSize = documents.size() / numThreads;
-    for (int i = 0; i < numThreads; ++i) {
-        int start = i * batchSize;
-        int end = (i == numThreads - 1) ? documents.size() : (i + 1) * batchSize;
-        preProcessingThreads.emplace_back(preprocessParallel, ref(documents), ref(preprocessedDocuments), ref(dictionary), ref(stopwords), start, end);
+    if (numa) {
+        cout << "NUMA nodes: " << pool.nodeCount() << endl;
+        for (int w = 0; w < numThreads; w++) {
+            cout << "  worker " << w << ": node " << pool.placement(w).node << ", cpu " << pool.placement(w).cpu << endl;
+        }
     }
 
-    for (auto& th : preProcessingThreads) {
-        th.join();
+    // List the article files, cut them into pieces and start reading them, in the order the workers will need them;
+    // with --numa each piece's pages are first faulted in by a worker of the node that will process it
+    beginStage(profiler);
+    vector<ArticleFile> files;
+    if (!listArticleFiles(articleFile, files)) {
+        return 1;
     }
-
-    // Calculate TF for each document
-    vector<unordered_map<string, double>> tfDocs(preprocessedDocuments.size());
-    vector<thread> tfThreads;
-    for (int i = 0; i < numThreads; ++i) {
-        int start = i * batchSize;
-        int end = (i == numThreads - 1) ? preprocessedDocuments.size() : (i + 1) * batchSize;
-        tfThreads.emplace_back(calculateTFParallel, ref(tfDocs), ref(preprocessedDocuments), start, end);
+    vector<ArticlePiece> pieces = cutPieces(files, numThreads);
+    size_t pieceChunk = chunkSizeFor(pieces.size(), numThreads);
+    if (numa) {
+        pool.parallelFor(pieces.size(), pieceChunk, [&](size_t begin, size_t end, int) {
+            touchPieces(files, pieces, begin, end);
+        });
     }
-
-    for (auto& th : tfThreads) {
-        th.join();
+    PieceReader reader(files, pieces, pool.scheduleOrder(pieces.size(), pieceChunk), allowRing);
+    uint64_t articleBytes = 0;
+    for (const auto& file : files) {
+        articleBytes += file.size;
     }
+    endStage(profiler, "list articles", 0, 0, 0);
+    cout << "Reading " << files.size() << " article files (" << articleBytes << " bytes) with " << reader.ioMethod() << "." << endl;
 
-    // Calculate IDF for the entire corpus
-    unordered_map<string, double> idf = calculateIDF(preprocessedDocuments);
+    // Intern the words kept by preprocessing and the query keywords as term IDs
+    beginStage(profiler);
+    Vocabulary vocabulary = buildVocabulary(dictionary, stopwords);
+    vector<uint32_t> keywordIds = lookupKeywords(vocabulary, keywords);
+    TermFilter filter = buildTermFilter(vocabulary);
+    endStage(profiler, "vocabulary", 0, 0, vocabulary.terms.size());
 
-    // Calculate TF-IDF scores for each document
-    vector<pair<double, pair<int, string>>> scores(preprocessedDocuments.size());
-    vector<thread> TFIDFThreads;
-    for (int i = 0; i < numThreads; ++i) {
-        int start = i * batchSize;
-        int end = (i == numThreads - 1) ? preprocessedDocuments.size() : (i + 1) * batchSize;
-        TFIDFThreads.emplace_back(calculateTFIDFScoreParallel, ref(scores), ref(tfDocs), ref(idf), ref(keywords), ref(preprocessedDocuments), start, end);
+    auto start = high_resolution_clock::now(); // Start timing
+
+    // Split each piece into documents as soon as it is read, then preprocess them and count their terms (TF) in a
+    // single pass, with a scratch counter, arena and DF table per worker that the worker allocates itself
+    beginStage(profiler);
+    vector<unique_ptr<TermCounter>> counters(numThreads);
+    vector<unique_ptr<pmr::monotonic_buffer_resource>> arenas(numThreads);
+    vector<vector<uint32_t>> localDFs(numThreads);
+    pool.onEachWorker([&](int worker) {
+        counters[worker] = make_unique<TermCounter>(vocabulary.terms.size(), filter.maxLength);
+        arenas[worker] = make_unique<pmr::monotonic_buffer_resource>(ARENA_BLOCK);
+        localDFs[worker].assign(vocabulary.terms.size(), 0);
+    });
+    atomic<bool> readFailed{false};
+    ThreadPool::PhaseStats preprocessStats = pool.parallelFor(pieces.size(), pieceChunk, [&](size_t begin, size_t end, int worker) {
+        if (!preprocessParallel(files, pieces, reader, *counters[worker], *arenas[worker], localDFs[worker], filter, begin, end)) {
+            readFailed = true;
+        }
+    });
+    if (readFailed) {
+        return 1;
     }
 
-    for (auto& th : TFIDFThreads) {
-        th.join();
+    // Number the documents in piece order, which is file order whichever read finished first
+    size_t numDocuments = 0;
+    uint64_t tokens = 0;
+    for (auto& piece : pieces) {
+        piece.firstDoc = numDocuments;
+        numDocuments += piece.documents.size();
+        for (uint32_t docLength : piece.docLengths) {
+            tokens += docLength;
+        }
     }
+    endStage(profiler, "preprocess", articleBytes, numDocuments, tokens, preprocessStats);
+    cout << "Processed " << numDocuments << " documents." << endl;
+
+    // Calculate IDF for the entire corpus by merging the per-worker DF tables, one shard of term IDs per chunk
+    beginStage(profiler);
+    vector<double> idf(vocabulary.terms.size(), 0.0);
+    ThreadPool::PhaseStats idfStats = pool.parallelFor(vocabulary.terms.size(), chunkSizeFor(vocabulary.terms.size(), numThreads), [&](size_t begin, size_t end, int) {
+        calculateIDFParallel(idf, localDFs, numDocuments, begin, end);
+    });
+    endStage(profiler, "idf", 0, numDocuments, 0, idfStats);
 
-    // Sort documents by their TF-IDF scores in descending order
-    // Note: If the Sim value is the same, sort the web pages in ascending order by web page number(docId).
-    stable_sort(scores.begin(), scores.end(), [](const pair<double, pair<int, string>>& a, const pair<double, pair<int, string>>& b) {
-        return a.first == b.first ? a.second < b.second : a.first > b.first;
+    // Calculate TF-IDF scores for each document, each worker keeping its best NUM (and at least 5 for the screen)
+    beginStage(profiler);
+    size_t k = max(numResults, 5);
+    vector<TopK> workerTops(numThreads, TopK(k));
+    ThreadPool::PhaseStats scoreStats = pool.parallelFor(pieces.size(), pieceChunk, [&](size_t begin, size_t end, int worker) {
+        calculateTFIDFScoreParallel(workerTops[worker], pieces, idf, keywordIds, begin, end);
     });
+    endStage(profiler, "score", 0, numDocuments, 0, scoreStats);
+
+    // Merge the per-worker selections within each node, then the per-node ones, and rank them by their TF-IDF scores in descending order
+    beginStage(profiler);
+    vector<TopK> nodeTops(pool.nodeCount(), TopK(k));
+    for (int w = 0; w < numThreads; w++) {
+        nodeTops[pool.nodeOf(w)].merge(workerTops[w]);
+    }
+    TopK top(k);
+    for (const auto& nodeTop : nodeTops) {
+        top.merge(nodeTop);
+    }
+    vector<pair<double, pair<int, string>>> scores; // <score, <docIndex, docID>>
+    for (const auto& entry : top.sorted()) {
+        scores.emplace_back(entry.first, make_pair(entry.second, string(documentID(pieces, entry.second))));
+    }
+    endStage(profiler, "sort", 0, scores.size(), 0);
 
     // Output the top 5 results to the screen
+    beginStage(profiler);
     cout << endl << "Top 5 results:" << endl;
     for (int i = 0; i < min(5, static_cast<int>(scores.size())); i++) {
         cout << fixed << setprecision(6) << scores[i].first << " " << scores[i].second.first << " " << scores[i].second.second << endl;
@@ -293,11 +1773,17 @@ int main(int argc, char* argv[]) {
         resultFile << fixed << setprecision(6) << scores[i].first << " " << scores[i].second.first << " " << scores[i].second.second << endl;
     }
     resultFile.close();
+    endStage(profiler, "write", fileSize("results.txt"), min(numResults, static_cast<int>(scores.size())), 0);
     
     auto end = high_resolution_clock::now(); // End timing
     auto duration = duration_cast<milliseconds>(end - start).count(); // Calculate the elapsed time in milliseconds
 
     cout << "Time taken: " << duration << " milliseconds" << endl; // Output the elapsed time
 
-    return 0;
+    cout << "Phases:" << endl;
+    reportPhase("preprocess", preprocessStats, numa);
+    reportPhase("idf", idfStats, numa);
+    reportPhase("score", scoreStats, numa);
+
+    return profileFile.empty() || writeProfile(profiler, profileFile, numThreads, numa, keywords) ? 0 : 1;
 }
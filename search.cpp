@@ -9,6 +9,38 @@
 #include <iomanip>              // For formatted input/output
 #include <cctype>               // For character classification
 #include <chrono>               // For measuring time
+#include <string_view>          // For zero-copy views into the article chunks
+#include <cstdint>              // For fixed-width integers in the index file
+#include <cstring>              // For comparing the index file header
+#include <memory>               // For sharing immutable index segments
+#include <shared_mutex>         // For letting queries run while nothing is being updated
+#include <mutex>                // For waking the merge thread
+#include <condition_variable>   // For waking the merge thread
+#include <thread>               // For merging segments in the background and reading ahead while tokenizing
+#include <deque>                // For the queue of chunks read ahead
+#include <functional>           // For the per-document callback of the article reader
+#include <list>                 // For the recency order of the result cache
+#include <ctime>                // For the CPU time of the profiled stages where getrusage is missing
+
+#ifdef __SSE2__
+#include <emmintrin.h>          // For scanning 16 bytes at a time in the tokenizer
+#endif
+#ifdef __SSSE3__
+#include <tmmintrin.h>          // For decoding compressed posting lists with byte shuffles
+#endif
+
+#ifndef _WIN32
+#include <unistd.h>             // For close
+#include <sys/resource.h>       // For the CPU time and peak memory of the profiled stages
+#include <sys/socket.h>         // For the query server socket
+#include <sys/un.h>             // For Unix domain socket addresses
+#include <netdb.h>              // For resolving TCP addresses
+#include <netinet/in.h>         // For TCP socket options
+#include <netinet/tcp.h>        // For TCP_NODELAY
+#include <sys/wait.h>           // For waiting on local shard workers
+#include <csignal>              // For ignoring SIGPIPE from disconnected clients
+#include <cerrno>               // For retrying interrupted system calls
+#endif
 
 using namespace std;
 using namespace chrono;
@@ -29,226 +61,3526 @@ unordered_set<string> readWords(const string& filename, unordered_set<string>& w
 }
 
 /*
-Using a vector of pair<string, string> to store the documents. Each pair consists of the document ID and its content. 
+Every stage of a run is measured: wall time, CPU time of the process, the bytes, documents and tokens (words kept
+by preprocessing) it handled, and the peak resident set size when it ended. The peak is the high-water mark of the
+whole run so far, so it never decreases from one stage to the next. With --profile the measurements are written
+as JSON, so runs over different corpus sizes can be compared stage by stage.
 */
-vector<pair<string, string>> readArticles(const string& filename, vector<pair<string, string>>& documents) {
-    ifstream file(filename);
-    if (!file.is_open()) {
+struct StageProfile {
+    string name;
+    double wallSeconds = 0;
+    double cpuSeconds = 0;
+    uint64_t bytes = 0;
+    uint64_t documents = 0;
+    uint64_t tokens = 0;
+    long peakRSSKilobytes = 0;
+};
+
+struct Profiler {
+    vector<StageProfile> stages;
+    high_resolution_clock::time_point stageStart;
+    double stageCPUStart = 0;
+};
+
+// Function to read the CPU time used by all threads of the process so far, in seconds
+double processCPUSeconds() {
+#ifndef _WIN32
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+#else
+    return static_cast<double>(clock()) / CLOCKS_PER_SEC;
+#endif
+}
+
+// Function to read the peak resident set size of the process so far, in kilobytes (0 where it is not available)
+long peakRSSKilobytes() {
+#if defined(_WIN32)
+    return 0;
+#else
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;      // macOS reports bytes
+#else
+    return usage.ru_maxrss;
+#endif
+#endif
+}
+
+// Function to find the size of a file in bytes, 0 if it cannot be opened
+uint64_t fileSize(const string& filename) {
+    ifstream file(filename, ios::binary | ios::ate);
+    return file.is_open() ? static_cast<uint64_t>(file.tellg()) : 0;
+}
+
+// Function to start measuring the next stage
+void beginStage(Profiler& profiler) {
+    profiler.stageStart = high_resolution_clock::now();
+    profiler.stageCPUStart = processCPUSeconds();
+}
+
+// Function to record the stage started by the last beginStage
+void endStage(Profiler& profiler, const string& name, uint64_t bytes, uint64_t documents, uint64_t tokens) {
+    StageProfile stage;
+    stage.name = name;
+    stage.wallSeconds = duration<double>(high_resolution_clock::now() - profiler.stageStart).count();
+    stage.cpuSeconds = processCPUSeconds() - profiler.stageCPUStart;
+    stage.bytes = bytes;
+    stage.documents = documents;
+    stage.tokens = tokens;
+    stage.peakRSSKilobytes = peakRSSKilobytes();
+    profiler.stages.push_back(stage);
+}
+
+// Function to write text as a JSON string literal
+void writeJSONString(ostream& out, const string& text) {
+    out << '"';
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out << '\\' << c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            out << "\\u" << hex << setw(4) << setfill('0') << static_cast<int>(c) << dec << setfill(' ');
+        } else {
+            out << c;
+        }
+    }
+    out << '"';
+}
+
+// Function to write the stages of a run as JSON
+bool writeProfile(const Profiler& profiler, const string& filename, const string& mode, const vector<string>& keywords) {
+    ofstream out(filename);
+    if (!out.is_open()) {
         cerr << "Unable to open file " << filename << endl;
-        return documents;
+        return false;
+    }
+
+    double totalWall = 0;
+    double totalCPU = 0;
+    for (const auto& stage : profiler.stages) {
+        totalWall += stage.wallSeconds;
+        totalCPU += stage.cpuSeconds;
     }
 
-    // Read the entire file content
-    string fileContent((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
-    file.close();
+    out << fixed << setprecision(6);
+    out << "{\n  \"program\": \"search\",\n  \"mode\": ";
+    writeJSONString(out, mode);
+    out << ",\n  \"threads\": 1,\n  \"keywords\": [";
+    for (size_t i = 0; i < keywords.size(); i++) {
+        out << (i > 0 ? ", " : "");
+        writeJSONString(out, keywords[i]);
+    }
+    out << "],\n  \"wallSeconds\": " << totalWall << ",\n  \"cpuSeconds\": " << totalCPU
+        << ",\n  \"peakRSSKilobytes\": " << peakRSSKilobytes() << ",\n  \"stages\": [";
+    for (size_t i = 0; i < profiler.stages.size(); i++) {
+        const StageProfile& stage = profiler.stages[i];
+        double seconds = stage.wallSeconds > 0 ? stage.wallSeconds : 1e-9;
+        out << (i > 0 ? "," : "") << "\n    {\"name\": ";
+        writeJSONString(out, stage.name);
+        out << ", \"wallSeconds\": " << stage.wallSeconds << ", \"cpuSeconds\": " << stage.cpuSeconds
+            << ", \"bytes\": " << stage.bytes << ", \"documents\": " << stage.documents << ", \"tokens\": " << stage.tokens
+            << ", \"bytesPerSecond\": " << stage.bytes / seconds << ", \"documentsPerSecond\": " << stage.documents / seconds
+            << ", \"tokensPerSecond\": " << stage.tokens / seconds << ", \"peakRSSKilobytes\": " << stage.peakRSSKilobytes << "}";
+    }
+    out << "\n  ]\n}\n";
+    return static_cast<bool>(out);
+}
 
-    // Split content by Form Feed character (\x0C)
-    stringstream ss(fileContent);
-    string document;
-    while (getline(ss, document, '\x0C')) {
-        if (!document.empty()) {
-            // Remove leading whitespace
-            document.erase(document.begin(), find_if(document.begin(), document.end(), [](int ch) {
-                return !isspace(ch);
-            }));
+/*
+The article file is streamed instead of being loaded: a reader thread reads it in fixed-size chunks while the
+calling thread splits the chunks into documents and tokenizes them, so disk reads overlap with tokenizing. The
+reader runs at most STREAM_QUEUE chunks ahead and chunk buffers are recycled, so memory use does not depend on the
+size of the corpus. A document that crosses a chunk boundary is the only text ever copied: its beginning is carried
+over and completed from the next chunk. Once a document has been visited its text is gone; the index keeps only
+its ID and term counts.
+*/
+const size_t STREAM_CHUNK = 1 << 20;   // Bytes per read
+const size_t STREAM_QUEUE = 4;         // Chunks read ahead of the tokenizer
 
-            // Split the document into lines
-            stringstream docStream(document);
-            string docID;
-            getline(docStream, docID); // The first line is the document ID
+struct ChunkQueue {
+    mutex lock;
+    condition_variable changed;
+    deque<string> full;                 // Chunks waiting to be split, in file order
+    vector<string> empty;               // Buffers handed back for reuse
+    bool finished = false;              // The reader has reached the end of the file
+};
 
-            string content;
-            string line;
-            while (getline(docStream, line)) {
-                content += line + " ";
+// Function run by the reader thread: read the file chunk by chunk into the queue
+void readChunks(ifstream& file, ChunkQueue& queue) {
+    while (true) {
+        string chunk;
+        {
+            unique_lock<mutex> wait(queue.lock);
+            queue.changed.wait(wait, [&queue] {
+                return queue.full.size() < STREAM_QUEUE;
+            });
+            if (!queue.empty.empty()) {
+                chunk = move(queue.empty.back());
+                queue.empty.pop_back();
             }
+        }
+
+        chunk.resize(STREAM_CHUNK);
+        file.read(&chunk[0], STREAM_CHUNK);
+        chunk.resize(file.gcount());
+        if (chunk.empty()) {
+            break;
+        }
+
+        lock_guard<mutex> hold(queue.lock);
+        queue.full.push_back(move(chunk));
+        queue.changed.notify_all();
+    }
+
+    lock_guard<mutex> hold(queue.lock);
+    queue.finished = true;
+    queue.changed.notify_all();
+}
+
+// Function to split one document into its ID (the first non-empty line) and content; false if it has no ID
+bool splitDocument(string_view document, string_view& docID, string_view& content) {
+    // Remove leading whitespace
+    size_t begin = 0;
+    while (begin < document.size() && isspace(static_cast<unsigned char>(document[begin]))) {
+        begin++;
+    }
+    document.remove_prefix(begin);
+
+    // The first line is the document ID, the remaining lines are the content
+    size_t lineEnd = document.find('\n');
+    docID = document.substr(0, lineEnd);
+    content = lineEnd == string_view::npos ? string_view() : document.substr(lineEnd + 1);
+    return !docID.empty();
+}
+
+/*
+Documents are separated by the Form Feed character (\x0C). visit is called for every document with a non-empty ID,
+in file order; the views are only valid during the call. numDocs receives the number of documents visited.
+*/
+bool streamArticles(const string& filename, const function<void(string_view, string_view)>& visit, size_t& numDocs) {
+    ifstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Unable to open file " << filename << endl;
+        return false;
+    }
+
+    ChunkQueue queue;
+    thread reader(readChunks, ref(file), ref(queue));
 
-            // Trim trailing whitespace from content
-            if (!content.empty() && content.back() == ' ') {
-                content.pop_back();
+    numDocs = 0;
+    string carry;                       // Beginning of a document that continues in the next chunk
+    auto visitDocument = [&](string_view document) {
+        string_view docID;
+        string_view content;
+        if (splitDocument(document, docID, content)) {
+            visit(docID, content);
+            numDocs++;
+        }
+    };
+
+    while (true) {
+        string chunk;
+        {
+            unique_lock<mutex> wait(queue.lock);
+            queue.changed.wait(wait, [&queue] {
+                return !queue.full.empty() || queue.finished;
+            });
+            if (queue.full.empty()) {
+                break;
             }
+            chunk = move(queue.full.front());
+            queue.full.pop_front();
+            queue.changed.notify_all();
+        }
 
-            // Add the document ID and content to the vector if docID is not empty
-            if (!docID.empty()) {
-                documents.emplace_back(docID, content);
+        string_view text(chunk);
+        size_t pos = 0;
+        size_t next;
+        while ((next = text.find('\x0C', pos)) != string_view::npos) {
+            if (carry.empty()) {
+                visitDocument(text.substr(pos, next - pos));
+            } else {
+                carry.append(text.data() + pos, next - pos);
+                visitDocument(carry);
+                carry.clear();
             }
+            pos = next + 1;
         }
+        carry.append(text.data() + pos, text.size() - pos);
+
+        lock_guard<mutex> hold(queue.lock);
+        queue.empty.push_back(move(chunk));
     }
+    reader.join();
 
-    return documents;
+    // The last document does not need a Form Feed after it
+    visitDocument(carry);
+    return true;
 }
 
 /*
-Using regular expressions to extract words and convert them to lowercase; then using the unordered_set
-for dictionary and stopwords to filter the words.
+Every dictionary word that is not a stopword is interned once as a dense 32-bit term ID. After preprocessing,
+documents, TF tables, IDF values and query keywords all refer to terms by ID, so the scoring loop never hashes or
+compares strings. IDs follow the sorted order of the words, which keeps them (and the index file) reproducible.
 */
-// Function to preprocess text: convert to lowercase, remove non-alphabetic characters, and remove stopwords and non-dictionary words
-string preProcessText(const string& text, const unordered_set<string>& dictionary, const unordered_set<string>& stopwords) {
-    string cleanedText;
-    string word;
-    for (char c : text) {
-        if (isalpha(c)) {
-            word += tolower(c);
-        } else {
-            if (!word.empty()) {
-                if (dictionary.find(word) != dictionary.end() && stopwords.find(word) == stopwords.end()) {
-                    cleanedText += word + " ";
+const uint32_t NO_TERM = UINT32_MAX;
+
+struct Vocabulary {
+    vector<string> terms;                       // term ID -> word
+    unordered_map<string_view, uint32_t> ids;   // word -> term ID, the keys point into terms
+
+    Vocabulary() = default;
+    Vocabulary(const Vocabulary&) = delete;
+    Vocabulary& operator=(const Vocabulary&) = delete;
+    Vocabulary(Vocabulary&&) = default;
+    Vocabulary& operator=(Vocabulary&&) = default;
+};
+
+// Function to index the words of a vocabulary once its term list is complete
+void finishVocabulary(Vocabulary& vocabulary) {
+    vocabulary.ids.clear();
+    vocabulary.ids.reserve(vocabulary.terms.size());
+    for (uint32_t id = 0; id < vocabulary.terms.size(); id++) {
+        vocabulary.ids.emplace(vocabulary.terms[id], id);
+    }
+}
+
+// Function to build the vocabulary of words kept by preprocessing: dictionary words that are not stopwords
+Vocabulary buildVocabulary(const unordered_set<string>& dictionary, const unordered_set<string>& stopwords) {
+    Vocabulary vocabulary;
+    for (const auto& word : dictionary) {
+        if (stopwords.find(word) == stopwords.end()) {
+            vocabulary.terms.push_back(word);
+        }
+    }
+    sort(vocabulary.terms.begin(), vocabulary.terms.end());
+    finishVocabulary(vocabulary);
+    return vocabulary;
+}
+
+// Function to find the term ID of a word, or NO_TERM if preprocessing never keeps it
+uint32_t lookupTerm(const Vocabulary& vocabulary, string_view word) {
+    auto it = vocabulary.ids.find(word);
+    return it == vocabulary.ids.end() ? NO_TERM : it->second;
+}
+
+// Function to map query keywords to term IDs, keeping their order (and repetitions) for scoring
+vector<uint32_t> lookupKeywords(const Vocabulary& vocabulary, const vector<string>& keywords) {
+    vector<uint32_t> keywordIds;
+    for (const auto& keyword : keywords) {
+        keywordIds.push_back(lookupTerm(vocabulary, keyword));
+    }
+    return keywordIds;
+}
+
+/*
+The token filter answers "does preprocessing keep this word, and with which term ID?" with a single probe. It is a
+perfect hash over the vocabulary (dictionary words minus stopwords), built once at startup: every word is hashed
+to a bucket, and each bucket stores a displacement chosen so that its words land in distinct, otherwise unused
+slots. A lookup hashes the word once, reads its bucket's displacement, and compares against the one word stored in
+that slot, so rejecting a token costs no allocation and no chain walking. Only words made of the letters a-z can
+ever be produced by the tokenizer, so other dictionary entries are left out.
+*/
+struct FilterSlot {
+    uint32_t id = NO_TERM;      // Term ID of the word stored in this slot, NO_TERM if the slot is empty
+    uint32_t offset = 0;        // Position of the word in TermFilter::chars
+    uint32_t length = 0;
+};
+
+struct TermFilter {
+    vector<uint32_t> displacements;     // bucket -> displacement that spreads its words over free slots
+    vector<FilterSlot> slots;
+    string chars;                       // All filtered words, back to back
+    size_t maxLength = 0;               // Longer tokens are rejected without hashing
+};
+
+// Function to hash a word, reading it 8 bytes at a time
+inline uint64_t hashWord(const char* word, size_t length) {
+    uint64_t h = length * 0x9E3779B97F4A7C15ULL;
+    for (; length >= 8; word += 8, length -= 8) {
+        uint64_t chunk;
+        memcpy(&chunk, word, 8);
+        h = (h ^ chunk) * 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 32;
+    }
+    if (length > 0) {
+        uint64_t chunk = 0;
+        memcpy(&chunk, word, length);
+        h = (h ^ chunk) * 0xC4CEB9FE1A85EC53ULL;
+        h ^= h >> 29;
+    }
+    return h;
+}
+
+// Function to pick a word's slot for a given bucket displacement
+inline size_t filterSlot(uint64_t hash, uint32_t displacement, size_t numSlots) {
+    uint64_t h = hash + displacement * 0x9E3779B97F4A7C15ULL;
+    h = (h ^ (h >> 33)) * 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    return static_cast<size_t>(h % numSlots);
+}
+
+inline size_t filterBucket(uint64_t hash, size_t numBuckets) {
+    return static_cast<size_t>((hash >> 32) % numBuckets);
+}
+
+// Function to compile the vocabulary into the perfect-hash token filter
+TermFilter buildTermFilter(const Vocabulary& vocabulary) {
+    TermFilter filter;
+    vector<uint32_t> ids;
+    for (uint32_t id = 0; id < vocabulary.terms.size(); id++) {
+        const string& word = vocabulary.terms[id];
+        if (!word.empty() && all_of(word.begin(), word.end(), [](char c) { return c >= 'a' && c <= 'z'; })) {
+            ids.push_back(id);
+            filter.maxLength = max(filter.maxLength, word.size());
+        }
+    }
+
+    // About four words per bucket and a load factor of 0.8 keep the displacement search short
+    size_t numBuckets = ids.size() / 4 + 1;
+    size_t numSlots = ids.size() + ids.size() / 4 + 1;
+    vector<vector<pair<uint64_t, uint32_t>>> buckets(numBuckets);   // <hash, term ID>
+    for (uint32_t id : ids) {
+        uint64_t hash = hashWord(vocabulary.terms[id].data(), vocabulary.terms[id].size());
+        buckets[filterBucket(hash, numBuckets)].emplace_back(hash, id);
+    }
+
+    // Place the largest buckets first, while the table is still mostly empty
+    vector<size_t> order(numBuckets);
+    for (size_t b = 0; b < numBuckets; b++) {
+        order[b] = b;
+    }
+    sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        return buckets[a].size() > buckets[b].size();
+    });
+
+    filter.displacements.assign(numBuckets, 0);
+    filter.slots.assign(numSlots, FilterSlot());
+    vector<size_t> chosen;
+    for (size_t b : order) {
+        if (buckets[b].empty()) {
+            break;
+        }
+        for (uint32_t displacement = 0;; displacement++) {
+            chosen.clear();
+            bool fits = true;
+            for (const auto& entry : buckets[b]) {
+                size_t slot = filterSlot(entry.first, displacement, numSlots);
+                if (filter.slots[slot].id != NO_TERM || find(chosen.begin(), chosen.end(), slot) != chosen.end()) {
+                    fits = false;
+                    break;
                 }
-                word.clear();
+                chosen.push_back(slot);
+            }
+            if (fits) {
+                filter.displacements[b] = displacement;
+                for (size_t i = 0; i < chosen.size(); i++) {
+                    filter.slots[chosen[i]].id = buckets[b][i].second;
+                }
+                break;
             }
         }
     }
 
-    // Process the last word
-    if (!word.empty() && dictionary.find(word) != dictionary.end() && stopwords.find(word) == stopwords.end()) {
-        cleanedText += word + " ";
+    // Store the words next to each other in slot order so a probe touches as little memory as possible
+    for (auto& slot : filter.slots) {
+        if (slot.id != NO_TERM) {
+            const string& word = vocabulary.terms[slot.id];
+            slot.offset = static_cast<uint32_t>(filter.chars.size());
+            slot.length = static_cast<uint32_t>(word.size());
+            filter.chars += word;
+        }
     }
 
-    return cleanedText;
+    return filter;
 }
 
-// Function to calculate term frequency (TF) for each word in each
-unordered_map<string, double> calculateTF(const string& text) {
-    unordered_map<string, double> tf;
-    stringstream ss(text);
+// Function to find the term ID of a lowercase token, or NO_TERM if preprocessing drops it
+inline uint32_t filterTerm(const TermFilter& filter, const char* word, size_t length) {
+    if (length > filter.maxLength || filter.slots.empty()) {
+        return NO_TERM;
+    }
+    uint64_t hash = hashWord(word, length);
+    uint32_t displacement = filter.displacements[filterBucket(hash, filter.displacements.size())];
+    const FilterSlot& slot = filter.slots[filterSlot(hash, displacement, filter.slots.size())];
+    if (slot.length == length && memcmp(filter.chars.data() + slot.offset, word, length) == 0) {
+        return slot.id;
+    }
+    return NO_TERM;
+}
 
-    string word;
-    int totalWords = 0;
+/*
+Preprocessing, TF counting and DF counting happen in a single pass over the raw text: each alphabetic run is
+lowercased, looked up in the token filter and counted straight away, without building a cleaned string that would
+have to be tokenized again. The counts live in a dense per-thread scratch array indexed by term ID; only the
+entries touched by the current document are read back and reset, so the cost stays proportional to the document.
+*/
+struct TermCounter {
+    vector<uint32_t> counts;    // term ID -> occurrences in the current document, zero between documents
+    vector<uint32_t> touched;   // term IDs with a non-zero count
+    vector<char> word;          // Lowercased copy of the current token, with room for a 16-byte store
 
-    while (ss >> word) {
-        tf[word]++;
-        totalWords++;
+    TermCounter(size_t numTerms, size_t maxLength) : counts(numTerms, 0), word(maxLength + 16) {}
+};
+
+// Function to count the token text[start, end) if preprocessing keeps it (a dictionary word that is not a stopword)
+inline void countWord(const char* text, size_t start, size_t end, size_t textLength, const TermFilter& filter, TermCounter& counter, uint32_t& totalWords) {
+    size_t length = end - start;
+    if (length > filter.maxLength) {
+        return;
     }
 
-    // Calculate term frequency (TF)
-    for (auto& pair : tf) {
-        pair.second = (pair.second/totalWords) * 100;
+    // Letters are lowercased by setting bit 0x20
+#ifdef __SSE2__
+    if (start + 16 <= textLength) {
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(text + start));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(counter.word.data()), _mm_or_si128(bytes, _mm_set1_epi8(0x20)));
+        for (size_t i = 16; i < length; i++) {
+            counter.word[i] = text[start + i] | 0x20;
+        }
+    } else
+#endif
+    {
+        (void)textLength;
+        for (size_t i = 0; i < length; i++) {
+            counter.word[i] = text[start + i] | 0x20;
+        }
+    }
+
+    uint32_t id = filterTerm(filter, counter.word.data(), length);
+    if (id != NO_TERM) {
+        if (counter.counts[id]++ == 0) {
+            counter.touched.push_back(id);
+        }
+        totalWords++;
     }
-    
-    return tf;
 }
 
-// Function to calculate inverse document frequency (IDF) for each word in the entire corpus
-unordered_map<string, double> calculateIDF(const vector<pair<string, string>>& documents) {
-    unordered_map<string, int> df;
-    unordered_map<string, double> idf;
-    int totalDocuments = documents.size();
+// Function to test for an ASCII letter, the same set isalpha accepts in the default "C" locale
+inline bool isLetter(char c) {
+    return static_cast<unsigned char>((c | 0x20) - 'a') < 26;
+}
 
-    // Calculate document frequency (DF)
-    for (const auto& doc : documents) {
-        unordered_set<string> uniqueWords;
-        stringstream ss(doc.second);
-        string word;
+#ifdef __SSE2__
+// Function to return a 16-bit mask with bit i set when block[i] is an ASCII letter
+inline uint32_t letterMask(const char* block) {
+    __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+    // (c | 0x20) - 'a' < 26, as a signed compare after shifting the range down by 128
+    __m128i shifted = _mm_add_epi8(_mm_or_si128(bytes, _mm_set1_epi8(0x20)), _mm_set1_epi8(static_cast<char>(-'a' - 128)));
+    __m128i letters = _mm_cmplt_epi8(shifted, _mm_set1_epi8(static_cast<char>(26 - 128)));
+    return static_cast<uint32_t>(_mm_movemask_epi8(letters));
+}
+#endif
+
+/*
+A document's term table is a vector of <term ID, count> pairs sorted by term ID. Only the raw counts are stored;
+TF is count / totalWords * 100, computed when a score needs it, so the table stays small and exact.
+*/
+// Function to preprocess text: convert to lowercase, remove non-alphabetic characters, remove stopwords and non-dictionary
+// words and count the remaining terms into tf. Returns the number of words kept (the document length).
+uint32_t preProcessText(string_view text, const TermFilter& filter, TermCounter& counter, vector<pair<uint32_t, uint32_t>>& tf) {
+    const char* data = text.data();
+    size_t length = text.size();
+    uint32_t totalWords = 0;
+    bool inWord = false;
+    size_t wordStart = 0;
+    size_t pos = 0;
 
-        while (ss >> word) {
-            uniqueWords.insert(word);
+#ifdef __SSE2__
+    // Find word boundaries 16 bytes at a time: each set bit in the mask is a letter
+    for (; pos + 16 <= length; pos += 16) {
+        uint32_t letters = letterMask(data + pos);
+        uint32_t bit = 0;
+        while (bit < 16) {
+            uint32_t remaining = (inWord ? ~letters : letters) & (0xFFFFu << bit) & 0xFFFFu;
+            if (remaining == 0) {
+                break;
+            }
+            bit = __builtin_ctz(remaining);
+            if (inWord) {
+                countWord(data, wordStart, pos + bit, length, filter, counter, totalWords);
+            } else {
+                wordStart = pos + bit;
+            }
+            inWord = !inWord;
         }
+    }
+#endif
 
-        for (const auto& word : uniqueWords) {
-            df[word]++;
+    // The tail (or the whole text without SSE2) one byte at a time
+    for (; pos < length; pos++) {
+        if (isLetter(data[pos]) != inWord) {
+            if (inWord) {
+                countWord(data, wordStart, pos, length, filter, counter, totalWords);
+            } else {
+                wordStart = pos;
+            }
+            inWord = !inWord;
         }
     }
 
-    // Calculate inverse document frequency (IDF)
-    for (const auto& pair : df) {
-        idf[pair.first] = log10(static_cast<double>(totalDocuments) / pair.second);
+    // Process the last word
+    if (inWord) {
+        countWord(data, wordStart, length, length, filter, counter, totalWords);
+    }
+
+    // Emit the term table in term ID order and reset the scratch counts for the next document
+    sort(counter.touched.begin(), counter.touched.end());
+    tf.clear();
+    tf.reserve(counter.touched.size());
+    for (uint32_t id : counter.touched) {
+        tf.emplace_back(id, counter.counts[id]);
+        counter.counts[id] = 0;
     }
+    counter.touched.clear();
 
-    return idf;
+    return totalWords;
 }
 
-// Function to calculate the TF-IDF score for a document given the keywords
-double calculateTFIDFScore(const unordered_map<string, double>& tf, const unordered_map<string, double>& idf, const vector<string>& keywords) {
-    double score = 0.0;
-    for (const auto& keyword : keywords) {
-        if (tf.find(keyword) != tf.end() && idf.find(keyword) != idf.end()) {
-            score += tf.at(keyword) * idf.at(keyword);
+// Function to calculate the term frequency (TF) of a term in a document of totalWords words
+double termFrequency(uint32_t count, uint32_t totalWords) {
+    return (static_cast<double>(count) / totalWords) * 100;
+}
+
+/*
+Posting lists are stored compressed, term-major. Each list is cut into blocks of 128 postings; a block holds the
+docIndex gaps (each docIndex minus the previous one) followed by the term counts, both in group varint: one control
+byte gives the byte length (1-4) of the next four values, which follow in little-endian order. Most gaps and counts
+fit in a single byte, so a posting takes about 2.5 bytes instead of 8. For every block the last docIndex and the
+byte offset are kept uncompressed, so a cursor can skip whole blocks without decoding them. With SSSE3 a group of
+four values is decoded with one byte shuffle, and the gaps are turned back into docIndex values with a SIMD prefix
+sum.
+*/
+const size_t POSTING_BLOCK = 128;
+const size_t DECODE_PADDING = 16;       // Bytes after the last group so a 16-byte load never reads past the data
+
+struct PostingBlock {
+    uint32_t lastDoc;                   // Largest docIndex - 1 in the block
+    uint32_t offset;                    // Position of the block in CompressedPostings::data
+};
+
+struct CompressedPostings {
+    uint32_t size = 0;                  // Number of postings, which is the document frequency of the term
+    vector<PostingBlock> blocks;
+    vector<uint8_t> data;
+
+    bool empty() const {
+        return size == 0;
+    }
+};
+
+// A partial block of postings waiting to be compressed
+struct PostingsBuilder {
+    vector<uint32_t> docs;
+    vector<uint32_t> counts;
+};
+
+// Function to append count values in group varint, padding the last group with zeros
+void encodeGroupVarint(const uint32_t* values, size_t count, vector<uint8_t>& out) {
+    for (size_t i = 0; i < count; i += 4) {
+        size_t control = out.size();
+        out.push_back(0);
+        for (size_t j = 0; j < 4; j++) {
+            uint32_t value = i + j < count ? values[i + j] : 0;
+            int bytes = value < (1u << 8) ? 1 : value < (1u << 16) ? 2 : value < (1u << 24) ? 3 : 4;
+            out[control] |= static_cast<uint8_t>((bytes - 1) << (2 * j));
+            for (int b = 0; b < bytes; b++) {
+                out.push_back(static_cast<uint8_t>(value >> (8 * b)));
+            }
         }
     }
-    return score;
 }
 
-int main(int argc, char* argv[]) {
-    if (argc < 3) {
-        cerr << "Usage: " << argv[0] << " NUM keyword1 keyword2 ... keywordN" << endl;
-        return 1;
+#ifdef __SSSE3__
+// Shuffle masks and encoded lengths for every control byte, built on first use
+struct GroupVarintTables {
+    alignas(16) uint8_t shuffles[256][16];
+    uint8_t lengths[256];
+
+    GroupVarintTables() {
+        for (int control = 0; control < 256; control++) {
+            int source = 0;
+            for (int j = 0; j < 4; j++) {
+                int bytes = ((control >> (2 * j)) & 3) + 1;
+                for (int b = 0; b < 4; b++) {
+                    shuffles[control][4 * j + b] = b < bytes ? static_cast<uint8_t>(source + b) : 0x80;
+                }
+                source += bytes;
+            }
+            lengths[control] = static_cast<uint8_t>(source);
+        }
     }
+};
 
-    int numResults = stoi(argv[1]);
-    vector<string> keywords;
-    for (int i = 2; i < argc; ++i) {
-        keywords.push_back(argv[i]);
+const GroupVarintTables& groupVarintTables() {
+    static const GroupVarintTables tables;
+    return tables;
+}
+#endif
+
+// Function to decode count values (rounded up to a multiple of 4) and return the position after them
+const uint8_t* decodeGroupVarint(const uint8_t* in, size_t count, uint32_t* out) {
+#ifdef __SSSE3__
+    const GroupVarintTables& tables = groupVarintTables();
+    for (size_t i = 0; i < count; i += 4) {
+        uint8_t control = *in++;
+        __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in));
+        __m128i shuffle = _mm_load_si128(reinterpret_cast<const __m128i*>(tables.shuffles[control]));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_shuffle_epi8(bytes, shuffle));
+        in += tables.lengths[control];
+    }
+#else
+    for (size_t i = 0; i < count; i += 4) {
+        uint8_t control = *in++;
+        for (size_t j = 0; j < 4; j++) {
+            int bytes = ((control >> (2 * j)) & 3) + 1;
+            uint32_t value = 0;
+            for (int b = 0; b < bytes; b++) {
+                value |= static_cast<uint32_t>(*in++) << (8 * b);
+            }
+            out[i + j] = value;
+        }
     }
+#endif
+    return in;
+}
 
-    string dictionaryFile = "data/dictionary.txt";
-    string stopwordsFile = "data/stopwords.txt";
-    string articleFile = "data/article.txt";
+// Function to turn count docIndex gaps (rounded up to a multiple of 4) into docIndex values, starting after base
+void prefixSum(uint32_t* values, size_t count, uint32_t base) {
+#ifdef __SSE2__
+    __m128i carry = _mm_set1_epi32(static_cast<int>(base));
+    for (size_t i = 0; i < count; i += 4) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(values + i));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 4));
+        x = _mm_add_epi32(x, _mm_slli_si128(x, 8));
+        x = _mm_add_epi32(x, carry);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(values + i), x);
+        carry = _mm_shuffle_epi32(x, _MM_SHUFFLE(3, 3, 3, 3));
+    }
+#else
+    for (size_t i = 0; i < count; i++) {
+        base += values[i];
+        values[i] = base;
+    }
+#endif
+}
 
-    // Read dictionary and stopwords
-    unordered_set<string> dictionary;
-    readWords(dictionaryFile, dictionary);
-    unordered_set<string> stopwords;
-    readWords(stopwordsFile, stopwords);
+// Function to compress the pending postings into a new block of the list
+void flushBlock(CompressedPostings& list, PostingsBuilder& pending) {
+    if (pending.docs.empty()) {
+        return;
+    }
+    uint32_t previous = list.blocks.empty() ? 0 : list.blocks.back().lastDoc;
+    uint32_t gaps[POSTING_BLOCK];
+    for (size_t i = 0; i < pending.docs.size(); i++) {
+        gaps[i] = pending.docs[i] - previous;
+        previous = pending.docs[i];
+    }
+
+    list.blocks.push_back({pending.docs.back(), static_cast<uint32_t>(list.data.size())});
+    encodeGroupVarint(gaps, pending.docs.size(), list.data);
+    encodeGroupVarint(pending.counts.data(), pending.counts.size(), list.data);
+    pending.docs.clear();
+    pending.counts.clear();
+}
 
-    cout << "Dictionary contains " << dictionary.size() << " words." << endl;
-    cout << "Stopwords contains " << stopwords.size() << " words." << endl;
+// Function to add a posting; postings must arrive in ascending docIndex order
+void appendPosting(CompressedPostings& list, PostingsBuilder& pending, uint32_t doc, uint32_t count) {
+    pending.docs.push_back(doc);
+    pending.counts.push_back(count);
+    list.size++;
+    if (pending.docs.size() == POSTING_BLOCK) {
+        flushBlock(list, pending);
+    }
+}
 
-    // Read and parse articles
-    vector<pair<string, string>> documents;
-    readArticles(articleFile, documents);
-    cout << "Processed " << documents.size() << " documents." << endl;
+// Function to compress the last partial block and add the padding needed by the SIMD decoder
+void finishPostings(CompressedPostings& list, PostingsBuilder& pending) {
+    flushBlock(list, pending);
+    list.data.resize(list.data.size() + DECODE_PADDING, 0);
+    list.data.shrink_to_fit();
+    list.blocks.shrink_to_fit();
+}
 
-    // Preprocess each document
-    vector<pair<string, string>> preprocessedDocuments;
-    for (const auto& doc : documents) {
-        string cleanedContent = preProcessText(doc.second, dictionary, stopwords);
-        preprocessedDocuments.emplace_back(doc.first, cleanedContent);
+// Function to return the position after count group varint values (rounded up to a multiple of 4) starting at offset,
+// reading only their control bytes; 0 if the groups do not end by limit
+size_t groupVarintEnd(const vector<uint8_t>& data, size_t offset, size_t count, size_t limit) {
+    for (size_t i = 0; i < count; i += 4) {
+        if (offset >= limit) {
+            return 0;
+        }
+        uint8_t control = data[offset];
+        offset += 1 + 4 + (control & 3) + ((control >> 2) & 3) + ((control >> 4) & 3) + (control >> 6);
+        if (offset > limit) {
+            return 0;
+        }
     }
+    return offset;
+}
 
-    // The Main Algorithms stars from here
-    auto start = high_resolution_clock::now(); // Start timing
+// Function to decode block b of a list into docs (docIndex - 1) and counts, returning the number of postings in it
+size_t decodeBlock(const CompressedPostings& list, size_t b, uint32_t* docs, uint32_t* counts) {
+    size_t count = b + 1 < list.blocks.size() ? POSTING_BLOCK : list.size - POSTING_BLOCK * (list.blocks.size() - 1);
+    size_t rounded = (count + 3) & ~size_t(3);
+    const uint8_t* in = list.data.data() + list.blocks[b].offset;
+    in = decodeGroupVarint(in, rounded, docs);
+    decodeGroupVarint(in, rounded, counts);
+    prefixSum(docs, rounded, b > 0 ? list.blocks[b - 1].lastDoc : 0);
+    return count;
+}
+
+/*
+The inverted index stores, for every term, the list of documents that contain it together with the number of
+times it occurs there (a posting). Keeping the document lengths in a side array is enough to recompute TF exactly
+as termFrequency does (count / totalWords * 100).
+
+The index is a sequence of segments covering consecutive docIndex ranges. The corpus read at startup is one
+segment; every batch of added documents becomes a small new segment, so adding an article never touches the
+existing posting lists. A segment only stores the terms that occur in it, in term ID order. Segments are never
+modified once built: a deleted document is only marked in a tombstone bitmap, and merging builds a new segment.
+The document frequency of every term counts live documents only and is updated on every add and delete, so IDF
+is always the one a full rebuild over the live documents would compute, while docIndex values stay stable.
+*/
+/*
+The document IDs of a segment are stored back to back in one string, with the end offset of each, instead of one
+heap string per document: building the index then allocates a few growing buffers instead of a block for every ID,
+and dropping a segment releases them at once.
+*/
+struct DocumentIDs {
+    string text;
+    vector<uint64_t> ends;
 
-    // Calculate TF for each document
-    vector<unordered_map<string, double>> tfDocs;
-    for (const auto& doc : preprocessedDocuments) {
-        tfDocs.push_back(calculateTF(doc.second));
+    size_t size() const {
+        return ends.size();
     }
 
-    // Calculate IDF for the entire corpus
-    unordered_map<string, double> idf = calculateIDF(preprocessedDocuments);
+    string_view operator[](size_t i) const {
+        size_t begin = i > 0 ? ends[i - 1] : 0;
+        return string_view(text).substr(begin, ends[i] - begin);
+    }
 
-    // Calculate TF-IDF scores for each document
-    vector<pair<double, pair<int, string>>> scores; // <score, <docIndex, docID>>
-    for (int i = 0; i < preprocessedDocuments.size(); i++) {
-        double score = calculateTFIDFScore(tfDocs[i], idf, keywords);
-        if (score > 0) {
-            scores.emplace_back(score, make_pair(i + 1, preprocessedDocuments[i].first));
+    void push_back(string_view docID) {
+        text.append(docID);
+        ends.push_back(text.size());
+    }
+};
+
+struct Segment {
+    uint32_t firstDoc = 0;                                      // docIndex - 1 of the first document
+    DocumentIDs docIDs;                                         // Document ID for each docIndex - 1 - firstDoc
+    vector<uint32_t> docLengths;                                // Number of preprocessed words in each document
+    vector<uint32_t> terms;                                     // Term IDs with postings in this segment, ascending
+    vector<CompressedPostings> postings;                        // <docIndex - 1, count> for each of terms, ascending
+    vector<double> maxTermFrequency;                            // Largest TF of each of terms in this segment
+
+    uint32_t endDoc() const {
+        return firstDoc + static_cast<uint32_t>(docIDs.size());
+    }
+};
+
+struct InvertedIndex {
+    Vocabulary vocabulary;                                      // Terms, indexed by term ID
+    TermFilter filter;                                          // Tokenizer filter for added documents
+    vector<shared_ptr<const Segment>> segments;                 // Consecutive docIndex ranges, ascending
+    vector<uint32_t> documentFrequency;                         // term ID -> number of live documents containing it
+    vector<bool> deleted;                                       // Tombstones, by docIndex - 1
+    uint32_t liveDocuments = 0;
+    uint64_t version = 0;                                       // Changes whenever documents are added or deleted
+    uint32_t numShards = 1;                                     // Shards of the corpus; only a whole corpus can grow
+    mutable shared_mutex lock;                                  // Shared by queries, exclusive for updates
+
+    // Background merging of small segments
+    mutex mergeMutex;
+    condition_variable mergeWanted;
+    bool mergePending = false;
+    bool stopMerging = false;
+    thread merger;
+};
+
+// A segment under construction; postings are collected for the terms in the order they first appear
+struct SegmentBuilder {
+    shared_ptr<Segment> segment;
+    vector<uint32_t> slots;                                     // term ID -> position in segment->terms, or NO_TERM
+    vector<PostingsBuilder> pending;                            // Partial block for each of segment->terms
+};
+
+// Function to start an empty segment whose first document gets docIndex firstDoc + 1
+void startSegment(SegmentBuilder& builder, size_t numTerms, uint32_t firstDoc) {
+    builder.segment = make_shared<Segment>();
+    builder.segment->firstDoc = firstDoc;
+    builder.slots.assign(numTerms, NO_TERM);
+    builder.pending.clear();
+}
+
+// Function to add the next document's term table to a segment; the table is not needed afterwards
+void addDocument(SegmentBuilder& builder, string_view docID, uint32_t docLength, const vector<pair<uint32_t, uint32_t>>& tf) {
+    Segment& segment = *builder.segment;
+    uint32_t doc = segment.endDoc();
+    segment.docIDs.push_back(docID);
+    segment.docLengths.push_back(docLength);
+
+    // Documents are added in order, so every posting list stays sorted by docIndex
+    for (const auto& entry : tf) {
+        uint32_t& slot = builder.slots[entry.first];
+        if (slot == NO_TERM) {
+            slot = static_cast<uint32_t>(segment.terms.size());
+            segment.terms.push_back(entry.first);
+            segment.postings.emplace_back();
+            segment.maxTermFrequency.push_back(0.0);
+            builder.pending.emplace_back();
         }
+        appendPosting(segment.postings[slot], builder.pending[slot], doc, entry.second);
+        segment.maxTermFrequency[slot] = max(segment.maxTermFrequency[slot], termFrequency(entry.second, docLength));
     }
+}
 
-    // Sort documents by their TF-IDF scores in descending order
-    // Note: If the Sim value is the same, sort the web pages in ascending order by web page number(docId).
-    stable_sort(scores.begin(), scores.end(), [](const pair<double, pair<int, string>>& a, const pair<double, pair<int, string>>& b) {
-        return a.first == b.first ? a.second < b.second : a.first > b.first;
+// Function to compress the remaining partial blocks and put the terms in term ID order
+shared_ptr<const Segment> finishSegment(SegmentBuilder& builder) {
+    Segment& segment = *builder.segment;
+    vector<uint32_t> order(segment.terms.size());
+    for (uint32_t i = 0; i < order.size(); i++) {
+        finishPostings(segment.postings[i], builder.pending[i]);
+        order[i] = i;
+    }
+    sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return segment.terms[a] < segment.terms[b];
     });
 
-    // Output the top 5 results to the screen
-    cout << endl << "Top 5 results:" << endl;
-    for (int i = 0; i < min(5, static_cast<int>(scores.size())); i++) {
-        cout << fixed << setprecision(6) << scores[i].first << " " << scores[i].second.first << " " << scores[i].second.second << endl;
+    vector<uint32_t> terms;
+    vector<CompressedPostings> postings;
+    vector<double> maxTermFrequency;
+    for (uint32_t i : order) {
+        terms.push_back(segment.terms[i]);
+        postings.push_back(move(segment.postings[i]));
+        maxTermFrequency.push_back(segment.maxTermFrequency[i]);
     }
+    segment.terms = move(terms);
+    segment.postings = move(postings);
+    segment.maxTermFrequency = move(maxTermFrequency);
 
-    auto end = high_resolution_clock::now(); // End timing
-    auto duration = duration_cast<milliseconds>(end - start).count(); // Calculate the elapsed time in milliseconds
+    builder.slots.clear();
+    builder.pending.clear();
+    return move(builder.segment);
+}
 
-    cout << "Time taken: " << duration << " milliseconds" << endl; // Output the elapsed time
+// Function to find the position of a term in a segment, or NO_TERM if no document of the segment contains it
+uint32_t findTerm(const Segment& segment, uint32_t id) {
+    auto it = lower_bound(segment.terms.begin(), segment.terms.end(), id);
+    return it != segment.terms.end() && *it == id ? static_cast<uint32_t>(it - segment.terms.begin()) : NO_TERM;
+}
 
-    // Output the top N results to the results.txt file
-    ofstream resultFile("results.txt");
-    for (int i = 0; i < min(numResults, static_cast<int>(scores.size())); i++) {
-        resultFile << fixed << setprecision(6) << scores[i].first << " " << scores[i].second.first << " " << scores[i].second.second << endl;
+// Function to append a finished segment to the index and count its documents; the caller holds the lock exclusively
+void appendSegment(InvertedIndex& index, shared_ptr<const Segment> segment) {
+    for (size_t i = 0; i < segment->terms.size(); i++) {
+        index.documentFrequency[segment->terms[i]] += segment->postings[i].size;
     }
-    resultFile.close();
-    
-    return 0;
+    index.deleted.resize(segment->endDoc(), false);
+    index.liveDocuments += static_cast<uint32_t>(segment->docIDs.size());
+    index.version++;
+    index.segments.push_back(move(segment));
+}
+
+// Function to start an empty index over a vocabulary
+void startIndex(InvertedIndex& index, Vocabulary vocabulary) {
+    index.filter = buildTermFilter(vocabulary);
+    index.documentFrequency.assign(vocabulary.terms.size(), 0);
+    index.vocabulary = move(vocabulary);
+}
+
+// Function to find the document ID of a docIndex
+string_view documentID(const InvertedIndex& index, int docIndex) {
+    uint32_t doc = docIndex - 1;
+    auto it = upper_bound(index.segments.begin(), index.segments.end(), doc, [](uint32_t d, const shared_ptr<const Segment>& segment) {
+        return d < segment->firstDoc;
+    });
+    const Segment& segment = **(it - 1);
+    return segment.docIDs[doc - segment.firstDoc];
+}
+
+// Function to count the terms that occur in at least one live document
+size_t countIndexedTerms(const InvertedIndex& index) {
+    size_t count = 0;
+    for (uint32_t df : index.documentFrequency) {
+        count += df > 0;
+    }
+    return count;
+}
+
+/*
+Index file layout (integers are 32-bit, native byte order):
+    "KWSIDX02" header, number of documents, then <ID length, ID bytes, document length> for every document,
+    number of terms, then for every term <term length, term bytes, posting count, largest TF (64-bit double),
+    block count, <last docIndex - 1, byte offset> per block, byte count, compressed bytes>.
+The compressed blocks are written as they are kept in memory, so loading needs no re-encoding. Only terms with
+postings are written, in sorted order, so the same corpus always produces the same file.
+*/
+const char INDEX_MAGIC[8] = {'K', 'W', 'S', 'I', 'D', 'X', '0', '2'};
+
+void writeUint32(ofstream& file, uint32_t value) {
+    file.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void writeString(ofstream& file, string_view text) {
+    writeUint32(file, static_cast<uint32_t>(text.size()));
+    file.write(text.data(), text.size());
+}
+
+bool readUint32(ifstream& file, uint32_t& value) {
+    return static_cast<bool>(file.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+// Function to read a length-prefixed string; false if it is cut off or longer than maxLength bytes
+bool readString(ifstream& file, string& text, uint64_t maxLength) {
+    uint32_t length;
+    if (!readUint32(file, length) || length > maxLength) {
+        return false;
+    }
+    text.resize(length);
+    return static_cast<bool>(file.read(&text[0], length));
+}
+
+// Function to write a freshly built inverted index (a single segment, nothing deleted) to a binary file
+bool writeIndex(const string& filename, const InvertedIndex& index) {
+    if (index.segments.size() != 1 || index.liveDocuments != index.deleted.size()) {
+        cerr << "Only a freshly built index can be saved" << endl;
+        return false;
+    }
+    const Segment& segment = *index.segments[0];
+
+    ofstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Unable to open file " << filename << endl;
+        return false;
+    }
+
+    file.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    writeUint32(file, static_cast<uint32_t>(segment.docIDs.size()));
+    for (size_t i = 0; i < segment.docIDs.size(); i++) {
+        writeString(file, segment.docIDs[i]);
+        writeUint32(file, segment.docLengths[i]);
+    }
+
+    // Term IDs follow the sorted order of the words
+    writeUint32(file, static_cast<uint32_t>(segment.terms.size()));
+    for (size_t i = 0; i < segment.terms.size(); i++) {
+        const auto& list = segment.postings[i];
+        writeString(file, index.vocabulary.terms[segment.terms[i]]);
+        writeUint32(file, list.size);
+        file.write(reinterpret_cast<const char*>(&segment.maxTermFrequency[i]), sizeof(double));
+        writeUint32(file, static_cast<uint32_t>(list.blocks.size()));
+        for (const auto& block : list.blocks) {
+            writeUint32(file, block.lastDoc);
+            writeUint32(file, block.offset);
+        }
+        writeUint32(file, static_cast<uint32_t>(list.data.size()));
+        file.write(reinterpret_cast<const char*>(list.data.data()), list.data.size());
+    }
+
+    return static_cast<bool>(file);
+}
+
+// Function to load an inverted index written by writeIndex
+bool readIndex(const string& filename, InvertedIndex& index) {
+    ifstream file(filename, ios::binary);
+    if (!file.is_open()) {
+        cerr << "Unable to open file " << filename << endl;
+        return false;
+    }
+
+    char magic[sizeof(INDEX_MAGIC)];
+    if (!file.read(magic, sizeof(magic)) || memcmp(magic, INDEX_MAGIC, sizeof(magic)) != 0) {
+        cerr << filename << " is not a search index (or was written by an older version; rebuild it)" << endl;
+        return false;
+    }
+
+    // Every count is checked against the file size before anything is allocated for it
+    uint64_t totalBytes = fileSize(filename);
+    auto segment = make_shared<Segment>();
+    uint32_t numDocs;
+    if (!readUint32(file, numDocs) || numDocs > totalBytes / 8) {
+        cerr << "Truncated index file " << filename << endl;
+        return false;
+    }
+    segment->docLengths.resize(numDocs);
+    string docID;
+    for (uint32_t i = 0; i < numDocs; i++) {
+        if (!readString(file, docID, totalBytes) || !readUint32(file, segment->docLengths[i])) {
+            cerr << "Truncated index file " << filename << endl;
+            return false;
+        }
+        segment->docIDs.push_back(docID);
+    }
+
+    uint32_t numTerms;
+    if (!readUint32(file, numTerms) || numTerms > totalBytes / 20) {
+        cerr << "Truncated index file " << filename << endl;
+        return false;
+    }
+    Vocabulary vocabulary;
+    vocabulary.terms.resize(numTerms);
+    segment->terms.resize(numTerms);
+    segment->postings.resize(numTerms);
+    segment->maxTermFrequency.resize(numTerms);
+    for (uint32_t id = 0; id < numTerms; id++) {
+        auto& list = segment->postings[id];
+        uint32_t numBlocks;
+        uint32_t dataSize;
+        segment->terms[id] = id;
+        if (!readString(file, vocabulary.terms[id], totalBytes) || !readUint32(file, list.size)
+            || !file.read(reinterpret_cast<char*>(&segment->maxTermFrequency[id]), sizeof(double)) || !readUint32(file, numBlocks)) {
+            cerr << "Truncated index file " << filename << endl;
+            return false;
+        }
+        if (list.size == 0 || numBlocks != (list.size + POSTING_BLOCK - 1) / POSTING_BLOCK || numBlocks > totalBytes / 8) {
+            cerr << "Corrupt index file " << filename << endl;
+            return false;
+        }
+        list.blocks.resize(numBlocks);
+        for (auto& block : list.blocks) {
+            if (!readUint32(file, block.lastDoc) || !readUint32(file, block.offset)) {
+                cerr << "Truncated index file " << filename << endl;
+                return false;
+            }
+        }
+        if (!readUint32(file, dataSize) || dataSize > totalBytes) {
+            cerr << "Truncated index file " << filename << endl;
+            return false;
+        }
+        list.data.resize(dataSize);
+        if (!file.read(reinterpret_cast<char*>(list.data.data()), dataSize)) {
+            cerr << "Truncated index file " << filename << endl;
+            return false;
+        }
+
+        // Reject lists that would make the decoder read out of bounds or point past the documents: the groups of every
+        // block must end where the next block (or the padding) starts, and every block is decoded once to check that its
+        // docIndex values increase, stay within the block's lastDoc and end on it
+        bool valid = dataSize >= DECODE_PADDING && list.blocks[0].offset == 0;
+        size_t limit = dataSize - DECODE_PADDING;
+        uint32_t docs[POSTING_BLOCK];
+        for (uint32_t b = 0; valid && b < numBlocks; b++) {
+            size_t count = b + 1 < numBlocks ? POSTING_BLOCK : list.size - POSTING_BLOCK * (numBlocks - 1);
+            size_t rounded = (count + 3) & ~size_t(3);
+            size_t end = groupVarintEnd(list.data, list.blocks[b].offset, rounded, limit);
+            end = end == 0 ? 0 : groupVarintEnd(list.data, end, rounded, limit);
+            valid = end != 0 && end == (b + 1 < numBlocks ? list.blocks[b + 1].offset : limit) && list.blocks[b].lastDoc < numDocs;
+            if (valid) {
+                uint32_t previous = b > 0 ? list.blocks[b - 1].lastDoc : 0;
+                decodeGroupVarint(list.data.data() + list.blocks[b].offset, rounded, docs);
+                prefixSum(docs, rounded, previous);
+                for (size_t i = 0; valid && i < count; i++) {
+                    valid = (docs[i] > previous || (b == 0 && i == 0)) && docs[i] <= list.blocks[b].lastDoc;
+                    previous = docs[i];
+                }
+                valid = valid && docs[count - 1] == list.blocks[b].lastDoc;
+            }
+        }
+        if (!valid) {
+            cerr << "Corrupt index file " << filename << endl;
+            return false;
+        }
+    }
+    finishVocabulary(vocabulary);
+
+    startIndex(index, move(vocabulary));
+    appendSegment(index, move(segment));
+    return true;
+}
+
+/*
+An index file only knows the words that occur in the saved corpus. Before documents are added to a loaded index,
+its terms are renumbered into the full vocabulary (dictionary words minus stopwords) so that new documents can use
+words the saved corpus never contained. Indexed words missing from the vocabulary are kept, at the end.
+*/
+void extendVocabulary(InvertedIndex& index, Vocabulary vocabulary) {
+    vector<uint32_t> remap(index.vocabulary.terms.size());
+    for (uint32_t id = 0; id < remap.size(); id++) {
+        remap[id] = lookupTerm(vocabulary, index.vocabulary.terms[id]);
+        if (remap[id] == NO_TERM) {
+            remap[id] = static_cast<uint32_t>(vocabulary.terms.size());
+            vocabulary.terms.push_back(index.vocabulary.terms[id]);
+        }
+    }
+    finishVocabulary(vocabulary);
+
+    vector<uint32_t> documentFrequency(vocabulary.terms.size(), 0);
+    for (uint32_t id = 0; id < remap.size(); id++) {
+        documentFrequency[remap[id]] = index.documentFrequency[id];
+    }
+    for (auto& segment : index.segments) {
+        auto renumbered = make_shared<Segment>(*segment);
+        vector<uint32_t> order(renumbered->terms.size());
+        for (uint32_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return remap[segment->terms[a]] < remap[segment->terms[b]];
+        });
+        for (size_t i = 0; i < order.size(); i++) {
+            renumbered->terms[i] = remap[segment->terms[order[i]]];
+            renumbered->postings[i] = segment->postings[order[i]];
+            renumbered->maxTermFrequency[i] = segment->maxTermFrequency[order[i]];
+        }
+        segment = move(renumbered);
+    }
+
+    index.filter = buildTermFilter(vocabulary);
+    index.documentFrequency = move(documentFrequency);
+    index.vocabulary = move(vocabulary);
+}
+
+/*
+Only the best NUM documents are ever printed, so instead of sorting every score the results are selected with a
+bounded heap of K entries: O(N log K), and no docID string is built for a document that does not make the cut.
+The heap keeps the lowest ranked of the current top K at its front, ready to be replaced.
+*/
+// Ranking order: TF-IDF score descending; if the Sim value is the same, ascending by web page number (docIndex)
+bool ranksBefore(const pair<double, int>& a, const pair<double, int>& b) {
+    return a.first == b.first ? a.second < b.second : a.first > b.first;
+}
+
+struct TopK {
+    size_t k;
+    vector<pair<double, int>> heap;     // <score, docIndex>
+
+    explicit TopK(size_t k) : k(k) {
+        heap.reserve(min<size_t>(k, 1 << 16));
+    }
+
+    // Function to offer a document to the selection
+    void push(double score, int docIndex) {
+        pair<double, int> entry(score, docIndex);
+        if (heap.size() < k) {
+            heap.push_back(entry);
+            push_heap(heap.begin(), heap.end(), ranksBefore);
+        } else if (k > 0 && ranksBefore(entry, heap.front())) {
+            pop_heap(heap.begin(), heap.end(), ranksBefore);
+            heap.back() = entry;
+            push_heap(heap.begin(), heap.end(), ranksBefore);
+        }
+    }
+
+    // Function to fold another selection (for example a worker's) into this one
+    void merge(const TopK& other) {
+        for (const auto& entry : other.heap) {
+            push(entry.first, entry.second);
+        }
+    }
+
+    // Function to return the selected documents, best first
+    vector<pair<double, int>> sorted() const {
+        vector<pair<double, int>> ranked(heap);
+        sort(ranked.begin(), ranked.end(), ranksBefore);
+        return ranked;
+    }
+};
+
+// Function to attach the document IDs to the selected documents, best first: <score, <docIndex, docID>>
+vector<pair<double, pair<int, string>>> rankedResults(const TopK& top, const InvertedIndex& index) {
+    vector<pair<double, pair<int, string>>> results;
+    for (const auto& entry : top.sorted()) {
+        results.emplace_back(entry.first, make_pair(entry.second, string(documentID(index, entry.second))));
+    }
+    return results;
+}
+
+/*
+A cursor walks one posting list in docIndex order, decoding one block at a time. skipTo first skips every block
+whose last docIndex is below the target using the uncompressed block headers, then searches inside the block.
+*/
+struct PostingCursor {
+    const CompressedPostings* list = nullptr;
+    size_t block = 0;                       // Block currently decoded
+    size_t position = 0;                    // Position inside the decoded block
+    size_t blockSize = 0;
+    size_t decoded = 0;                     // Postings decoded so far, for the profile
+    uint32_t docs[POSTING_BLOCK];
+    uint32_t counts[POSTING_BLOCK];
+
+    explicit PostingCursor(const CompressedPostings* list) : list(list) {
+        if (!list->blocks.empty()) {
+            blockSize = decodeBlock(*list, 0, docs, counts);
+            decoded += blockSize;
+        }
+    }
+
+    bool atEnd() const {
+        return block >= list->blocks.size();
+    }
+
+    uint32_t doc() const {
+        return docs[position];
+    }
+
+    uint32_t count() const {
+        return counts[position];
+    }
+
+    void next() {
+        if (++position == blockSize) {
+            position = 0;
+            if (++block < list->blocks.size()) {
+                blockSize = decodeBlock(*list, block, docs, counts);
+                decoded += blockSize;
+            }
+        }
+    }
+
+    // Function to move to the first posting whose docIndex is >= target
+    void skipTo(uint32_t target) {
+        if (atEnd() || doc() >= target) {
+            return;
+        }
+        if (list->blocks[block].lastDoc < target) {
+            auto it = lower_bound(list->blocks.begin() + block + 1, list->blocks.end(), target, [](const PostingBlock& b, uint32_t t) {
+                return b.lastDoc < t;
+            });
+            block = it - list->blocks.begin();
+            position = 0;
+            if (atEnd()) {
+                return;
+            }
+            blockSize = decodeBlock(*list, block, docs, counts);
+            decoded += blockSize;
+        }
+        position = lower_bound(docs + position, docs + blockSize, target) - docs;
+    }
+};
+
+// Function to check whether a posting list contains a document
+bool containsDocument(const CompressedPostings& list, uint32_t doc) {
+    PostingCursor cursor(&list);
+    cursor.skipTo(doc);
+    return !cursor.atEnd() && cursor.doc() == doc;
+}
+
+/*
+Adding documents tokenizes them into a new segment without holding the lock, then appends the segment and its
+document frequencies in one short exclusive section. Only the thread serving requests adds or deletes documents.
+*/
+bool addDocuments(InvertedIndex& index, const string& articleFile, uint32_t& firstDoc, uint32_t& added) {
+    {
+        shared_lock<shared_mutex> lock(index.lock);
+        firstDoc = static_cast<uint32_t>(index.deleted.size());
+    }
+    TermCounter counter(index.vocabulary.terms.size(), index.filter.maxLength);
+    SegmentBuilder builder;
+    startSegment(builder, index.vocabulary.terms.size(), firstDoc);
+    vector<pair<uint32_t, uint32_t>> tf;
+    size_t numDocs;
+    bool opened = streamArticles(articleFile, [&](string_view docID, string_view content) {
+        uint32_t docLength = preProcessText(content, index.filter, counter, tf);
+        addDocument(builder, docID, docLength, tf);
+    }, numDocs);
+    if (!opened) {
+        return false;
+    }
+    added = static_cast<uint32_t>(numDocs);
+    if (added == 0) {
+        return true;
+    }
+    shared_ptr<const Segment> segment = finishSegment(builder);
+
+    {
+        unique_lock<shared_mutex> lock(index.lock);
+        appendSegment(index, move(segment));
+    }
+    {
+        lock_guard<mutex> wake(index.mergeMutex);
+        index.mergePending = true;
+    }
+    index.mergeWanted.notify_one();
+    return true;
+}
+
+/*
+Deleting a document marks it in the tombstone bitmap and takes it out of the document frequency of every term it
+contains. The segment does not keep the document's terms, so each posting list of the segment is probed through
+its block headers; deletes are rare next to queries, and nothing else has to be rebuilt.
+*/
+uint32_t deleteDocuments(InvertedIndex& index, const string& docID) {
+    unique_lock<shared_mutex> lock(index.lock);
+    uint32_t removed = 0;
+    for (const auto& segment : index.segments) {
+        for (uint32_t i = 0; i < segment->docIDs.size(); i++) {
+            uint32_t doc = segment->firstDoc + i;
+            if (index.deleted[doc] || segment->docIDs[i] != docID) {
+                continue;
+            }
+            index.deleted[doc] = true;
+            index.liveDocuments--;
+            index.version++;
+            removed++;
+            for (size_t t = 0; t < segment->terms.size(); t++) {
+                if (containsDocument(segment->postings[t], doc)) {
+                    index.documentFrequency[segment->terms[t]]--;
+                }
+            }
+        }
+    }
+    return removed;
+}
+
+// Function to combine two adjacent segments, dropping the postings of documents deleted so far
+shared_ptr<const Segment> mergeSegments(const Segment& first, const Segment& second, const vector<bool>& deleted) {
+    auto merged = make_shared<Segment>();
+    merged->firstDoc = first.firstDoc;
+    for (const Segment* segment : {&first, &second}) {
+        for (size_t i = 0; i < segment->docIDs.size(); i++) {
+            // A deleted document keeps its docIndex, but not its ID
+            bool gone = deleted[segment->firstDoc + i - first.firstDoc];
+            merged->docIDs.push_back(gone ? string_view() : segment->docIDs[i]);
+            merged->docLengths.push_back(segment->docLengths[i]);
+        }
+    }
+
+    size_t a = 0;
+    size_t b = 0;
+    PostingsBuilder pending;
+    while (a < first.terms.size() || b < second.terms.size()) {
+        uint32_t id = min(a < first.terms.size() ? first.terms[a] : NO_TERM, b < second.terms.size() ? second.terms[b] : NO_TERM);
+        CompressedPostings list;
+        double maxTermFrequency = 0.0;
+        for (auto source : {make_pair(&first, &a), make_pair(&second, &b)}) {
+            const Segment& segment = *source.first;
+            size_t& position = *source.second;
+            if (position == segment.terms.size() || segment.terms[position] != id) {
+                continue;
+            }
+            for (PostingCursor cursor(&segment.postings[position]); !cursor.atEnd(); cursor.next()) {
+                if (!deleted[cursor.doc() - first.firstDoc]) {
+                    appendPosting(list, pending, cursor.doc(), cursor.count());
+                    double tf = termFrequency(cursor.count(), merged->docLengths[cursor.doc() - first.firstDoc]);
+                    maxTermFrequency = max(maxTermFrequency, tf);
+                }
+            }
+            position++;
+        }
+        if (!list.empty()) {
+            finishPostings(list, pending);
+            merged->terms.push_back(id);
+            merged->postings.push_back(move(list));
+            merged->maxTermFrequency.push_back(maxTermFrequency);
+        }
+    }
+    return merged;
+}
+
+/*
+Merge policy: a segment is folded into the one before it as soon as it holds at least half as many documents.
+Segment sizes then shrink geometrically from the oldest to the newest, so there are O(log N) segments and every
+document is rewritten O(log N) times over the life of the index.
+*/
+size_t pickMerge(const vector<shared_ptr<const Segment>>& segments) {
+    for (size_t i = segments.size(); i-- > 1;) {
+        if (2 * segments[i]->docIDs.size() >= segments[i - 1]->docIDs.size()) {
+            return i - 1;
+        }
+    }
+    return SIZE_MAX;
+}
+
+/*
+The merge thread snapshots two adjacent segments and their tombstones under the shared lock, builds the merged
+segment while queries keep running, and swaps it in under the exclusive lock. Segments are only appended by
+adds and only replaced here, so the pair is still at the same position when the merge is done. Documents deleted
+during the merge are still tombstoned in the bitmap, which queries check, so nothing has to be redone.
+*/
+void mergeInBackground(InvertedIndex& index) {
+    while (true) {
+        shared_ptr<const Segment> first;
+        shared_ptr<const Segment> second;
+        vector<bool> deleted;
+        size_t at;
+        {
+            shared_lock<shared_mutex> lock(index.lock);
+            at = pickMerge(index.segments);
+            if (at != SIZE_MAX) {
+                first = index.segments[at];
+                second = index.segments[at + 1];
+                deleted.assign(index.deleted.begin() + first->firstDoc, index.deleted.begin() + second->endDoc());
+            }
+        }
+
+        if (at == SIZE_MAX) {
+            unique_lock<mutex> wait(index.mergeMutex);
+            index.mergeWanted.wait(wait, [&index] {
+                return index.mergePending || index.stopMerging;
+            });
+            index.mergePending = false;
+            if (index.stopMerging) {
+                return;
+            }
+            continue;
+        }
+
+        shared_ptr<const Segment> merged = mergeSegments(*first, *second, deleted);
+        {
+            unique_lock<shared_mutex> lock(index.lock);
+            index.segments[at] = move(merged);
+            index.segments.erase(index.segments.begin() + at + 1);
+        }
+
+        lock_guard<mutex> wake(index.mergeMutex);
+        if (index.stopMerging) {
+            return;
+        }
+    }
+}
+
+// Function to start the background merge thread
+void startMerging(InvertedIndex& index) {
+    index.merger = thread(mergeInBackground, ref(index));
+}
+
+// Function to stop the background merge thread, letting a merge in progress finish
+void stopMerging(InvertedIndex& index) {
+    {
+        lock_guard<mutex> wake(index.mergeMutex);
+        index.stopMerging = true;
+    }
+    index.mergeWanted.notify_one();
+    if (index.merger.joinable()) {
+        index.merger.join();
+    }
+}
+
+// A distinct query term: its IDF and how often it appears in the query
+struct QueryTerm {
+    uint32_t id;
+    double idf;
+    int multiplicity;
+};
+
+// A query term inside one segment: its posting list cursor and the most it can add to a score there
+struct SegmentTerm {
+    size_t term;                            // Position in the query's term list
+    double upperBound;
+    PostingCursor cursor;
+};
+
+// Upper bounds are sums in a different order than the exact score; pad them so rounding can never prune a winner
+inline double padBound(double bound) {
+    return bound * (1 + 1e-12);
+}
+
+/*
+Query evaluation is document-at-a-time over the posting lists of the query terms, with MaxScore pruning, so only
+documents that contain at least one keyword are visited. Each term's upper bound is its largest TF in the segment
+times its IDF times its number of occurrences in the query. Terms are ordered by bound; once the top k is full,
+the cheapest terms whose bounds add up to no more than the current k-th score are non-essential: a document that
+contains only those can never enter the results, so candidates are drawn from the essential lists alone and the
+non-essential lists are probed with skipTo only while the candidate can still make the cut.
+Scores are recomputed keyword by keyword in query order, exactly like the full scan, and candidates arrive in
+ascending docIndex, so a later document needs a strictly higher score to displace an earlier one. Segments are
+visited in docIndex order and share one top k, so scores and tie order match the full scan over live documents.
+*/
+// Returns the number of postings decoded.
+size_t searchSegment(const Segment& segment, const vector<bool>& deleted, const vector<QueryTerm>& queryTerms, const vector<int>& keywordSlots, TopK& top) {
+    vector<SegmentTerm> terms;
+    for (size_t q = 0; q < queryTerms.size(); q++) {
+        uint32_t position = findTerm(segment, queryTerms[q].id);
+        if (position != NO_TERM) {
+            double upperBound = queryTerms[q].multiplicity * segment.maxTermFrequency[position] * queryTerms[q].idf;
+            terms.push_back({q, upperBound, PostingCursor(&segment.postings[position])});
+        }
+    }
+    if (terms.empty()) {
+        return 0;
+    }
+    sort(terms.begin(), terms.end(), [](const SegmentTerm& a, const SegmentTerm& b) {
+        return a.upperBound < b.upperBound;
+    });
+
+    // prefixBound[i] bounds the total contribution of terms 0..i; termSlots maps each query term to its cursor
+    vector<double> prefixBound(terms.size());
+    vector<int> termSlots(queryTerms.size(), -1);
+    for (size_t i = 0; i < terms.size(); i++) {
+        prefixBound[i] = terms[i].upperBound + (i > 0 ? prefixBound[i - 1] : 0.0);
+        termSlots[terms[i].term] = static_cast<int>(i);
+    }
+
+    size_t k = top.k;
+    vector<uint32_t> counts(terms.size(), 0);
+    size_t firstEssential = 0;
+    while (true) {
+        // A new document has to beat the current k-th score (any positive score while the top k is not full)
+        double threshold = top.heap.size() == k ? top.heap.front().first : 0.0;
+        while (firstEssential < terms.size() && padBound(prefixBound[firstEssential]) <= threshold) {
+            firstEssential++;
+        }
+
+        uint32_t candidate = UINT32_MAX;
+        for (size_t i = firstEssential; i < terms.size(); i++) {
+            if (!terms[i].cursor.atEnd()) {
+                candidate = min(candidate, terms[i].cursor.doc());
+            }
+        }
+        if (candidate == UINT32_MAX) {
+            break;
+        }
+
+        double docLength = segment.docLengths[candidate - segment.firstDoc];
+        double partial = 0.0;
+        for (size_t i = firstEssential; i < terms.size(); i++) {
+            counts[i] = 0;
+            if (!terms[i].cursor.atEnd() && terms[i].cursor.doc() == candidate) {
+                counts[i] = terms[i].cursor.count();
+                partial += queryTerms[terms[i].term].multiplicity * termFrequency(counts[i], docLength) * queryTerms[terms[i].term].idf;
+                terms[i].cursor.next();
+            }
+        }
+        if (deleted[candidate]) {
+            continue;
+        }
+
+        // Probe the non-essential terms from the largest bound down while the candidate can still make the cut
+        bool pruned = false;
+        for (size_t i = firstEssential; i-- > 0;) {
+            if (padBound(partial + prefixBound[i]) <= threshold) {
+                pruned = true;
+                break;
+            }
+            counts[i] = 0;
+            terms[i].cursor.skipTo(candidate);
+            if (!terms[i].cursor.atEnd() && terms[i].cursor.doc() == candidate) {
+                counts[i] = terms[i].cursor.count();
+                partial += queryTerms[terms[i].term].multiplicity * termFrequency(counts[i], docLength) * queryTerms[terms[i].term].idf;
+            }
+        }
+        if (pruned) {
+            continue;
+        }
+
+        // Exact score, accumulated in keyword order like the full scan
+        double score = 0.0;
+        for (int slot : keywordSlots) {
+            int i = slot >= 0 ? termSlots[slot] : -1;
+            if (i >= 0 && counts[i] > 0) {
+                score += termFrequency(counts[i], segment.docLengths[candidate - segment.firstDoc]) * queryTerms[slot].idf;
+            }
+        }
+        if (score > 0) {
+            top.push(score, candidate + 1);
+        }
+    }
+
+    size_t decoded = 0;
+    for (const auto& term : terms) {
+        decoded += term.cursor.decoded;
+    }
+    return decoded;
+}
+
+/*
+The statistics IDF is computed from: the number of documents and the document frequency of each query keyword.
+They are normally the index's own; a shard of a larger corpus is given the totals over all shards instead, so its
+scores are the ones a single index over the whole corpus would give.
+*/
+struct CorpusStats {
+    uint64_t documents = 0;
+    vector<uint64_t> keywordDF;                                 // One per keyword, in keyword order
+};
+
+// Function to collect the distinct query terms that can contribute to a score: known, in some live document and
+// not in every live document. keywordSlots maps every keyword to its query term, or -1. The caller holds the lock.
+void planQuery(const InvertedIndex& index, const vector<string>& keywords, vector<QueryTerm>& queryTerms, vector<int>& keywordSlots, const CorpusStats* global = nullptr) {
+    vector<uint32_t> keywordIds = lookupKeywords(index.vocabulary, keywords);
+    queryTerms.clear();
+    keywordSlots.clear();
+    for (size_t i = 0; i < keywordIds.size(); i++) {
+        uint32_t id = keywordIds[i];
+        auto it = find_if(queryTerms.begin(), queryTerms.end(), [id](const QueryTerm& term) { return term.id == id; });
+        if (it != queryTerms.end()) {
+            it->multiplicity++;
+            keywordSlots.push_back(static_cast<int>(it - queryTerms.begin()));
+            continue;
+        }
+        uint64_t documents = global ? global->documents : index.liveDocuments;
+        uint64_t df = id == NO_TERM ? 0 : global ? global->keywordDF[i] : index.documentFrequency[id];
+        double idf = df == 0 ? 0.0 : log10(static_cast<double>(documents) / df);
+        if (idf > 0) {
+            keywordSlots.push_back(static_cast<int>(queryTerms.size()));
+            queryTerms.push_back({id, idf, 1});
+        } else {
+            keywordSlots.push_back(-1);
+        }
+    }
+}
+
+// Function to return the top k documents for the keywords, best first; IDF comes from global if it is given, and the
+// number of postings decoded is added to decodedPostings if it is given
+vector<pair<double, pair<int, string>>> searchIndex(const InvertedIndex& index, const vector<string>& keywords, size_t k, const CorpusStats* global = nullptr, size_t* decodedPostings = nullptr) {
+    TopK top(k);
+    if (k == 0) {
+        return {};
+    }
+    shared_lock<shared_mutex> lock(index.lock);
+
+    vector<QueryTerm> queryTerms;
+    vector<int> keywordSlots;
+    planQuery(index, keywords, queryTerms, keywordSlots, global);
+    if (queryTerms.empty()) {
+        return {};
+    }
+
+    for (const auto& segment : index.segments) {
+        size_t decoded = searchSegment(*segment, index.deleted, queryTerms, keywordSlots, top);
+        if (decodedPostings != nullptr) {
+            *decodedPostings += decoded;
+        }
+    }
+    return rankedResults(top, index);
+}
+
+/*
+Batch mode answers a whole file of queries. Queries that share a term are put in the same group (connected
+components over shared terms), and each group is answered in one go: the posting list of every term of the group
+is decompressed once, over all segments and without deleted documents, and every query of the group is scored
+from the decoded lists while they are still in cache. Each query keeps its own top NUM, and scores are computed
+keyword by keyword in query order as in searchIndex, so every answer is exactly the one the query gets alone.
+*/
+struct BatchQuery {
+    string line;
+    int numResults = -1;                    // -1 if the line is not a valid query
+    vector<QueryTerm> queryTerms;
+    vector<int> keywordSlots;
+    vector<pair<double, pair<int, string>>> results;
+    string error;                           // Why a boolean query is invalid
+};
+
+struct DecodedPostings {
+    vector<uint32_t> docs;                  // docIndex - 1, ascending
+    vector<uint32_t> counts;
+};
+
+// Function to decode a term's postings in every segment, leaving out deleted documents
+void decodePostings(const InvertedIndex& index, uint32_t id, DecodedPostings& decoded) {
+    uint32_t docs[POSTING_BLOCK];
+    uint32_t counts[POSTING_BLOCK];
+    decoded.docs.clear();
+    decoded.counts.clear();
+    for (const auto& segment : index.segments) {
+        uint32_t position = findTerm(*segment, id);
+        if (position == NO_TERM) {
+            continue;
+        }
+        const CompressedPostings& list = segment->postings[position];
+        for (size_t b = 0; b < list.blocks.size(); b++) {
+            size_t size = decodeBlock(list, b, docs, counts);
+            for (size_t i = 0; i < size; i++) {
+                if (!index.deleted[docs[i]]) {
+                    decoded.docs.push_back(docs[i]);
+                    decoded.counts.push_back(counts[i]);
+                }
+            }
+        }
+    }
+}
+
+// Function to score one query of a batch by merging the decoded posting lists of its terms
+void scoreDecoded(BatchQuery& query, const vector<const DecodedPostings*>& lists, const vector<uint32_t>& docLengths, const InvertedIndex& index) {
+    TopK top(query.numResults);
+    vector<size_t> positions(lists.size(), 0);
+    vector<uint32_t> counts(lists.size(), 0);
+    while (true) {
+        uint32_t candidate = UINT32_MAX;
+        for (size_t i = 0; i < lists.size(); i++) {
+            if (positions[i] < lists[i]->docs.size()) {
+                candidate = min(candidate, lists[i]->docs[positions[i]]);
+            }
+        }
+        if (candidate == UINT32_MAX) {
+            break;
+        }
+        for (size_t i = 0; i < lists.size(); i++) {
+            counts[i] = 0;
+            if (positions[i] < lists[i]->docs.size() && lists[i]->docs[positions[i]] == candidate) {
+                counts[i] = lists[i]->counts[positions[i]++];
+            }
+        }
+
+        // Exact score, accumulated in keyword order like the full scan
+        double score = 0.0;
+        for (int slot : query.keywordSlots) {
+            if (slot >= 0 && counts[slot] > 0) {
+                score += termFrequency(counts[slot], docLengths[candidate]) * query.queryTerms[slot].idf;
+            }
+        }
+        if (score > 0) {
+            top.push(score, candidate + 1);
+        }
+    }
+    query.results = rankedResults(top, index);
+}
+
+/*
+A query that uses any operator is a boolean query:
+    +word       the document must contain word
+    -word       the document must not contain word; NOT word means the same
+    a AND b     both; AND binds tighter than the list of clauses around it
+    a OR b      either; a plain list of keywords has always meant OR, and still does
+    ( ... )     grouping; +( ... ), -( ... ) and NOT ( ... ) apply to the whole group
+NOT, + and - apply to the keyword or group right after them. As in most search engines, within a list of clauses every required (+) clause must match, no prohibited (-) clause
+may match, and when there are no required clauses at least one of the others must match; next to required
+clauses the others only add to the score. Matching only selects documents: they are ranked with the usual TF-IDF
+score over the keywords that are not negated, in query order, and only positive scores are returned, so a query
+of nothing but negations matches nothing.
+*/
+struct BooleanNode {
+    string word;                            // A single keyword if there are no children
+    vector<BooleanNode> children;
+    vector<char> modifiers;                 // For each child: '+' required, '-' prohibited, ' ' optional
+};
+
+struct BooleanQuery {
+    BooleanNode root;
+    vector<string> keywords;                // The keywords that are scored: not negated, in query order
+};
+
+// Function to tell whether a query uses any operator
+bool isBooleanQuery(const vector<string>& keywords) {
+    for (const auto& keyword : keywords) {
+        if (keyword == "AND" || keyword == "OR" || keyword == "NOT" || keyword[0] == '+' || keyword[0] == '-'
+            || keyword.find_first_of("()") != string::npos) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Function to split the query words (a quoted argument may hold several) into keywords, operators and parentheses
+vector<string> tokenizeBooleanQuery(const vector<string>& arguments) {
+    vector<string> keywords;
+    for (const auto& argument : arguments) {
+        stringstream words(argument);
+        string word;
+        while (words >> word) {
+            keywords.push_back(word);
+        }
+    }
+
+    vector<string> tokens;
+    for (const auto& keyword : keywords) {
+        size_t begin = 0;
+        size_t end = keyword.size();
+        while (begin < end && (keyword[begin] == '+' || keyword[begin] == '-' || keyword[begin] == '(')) {
+            tokens.push_back(string(1, keyword[begin++]));
+        }
+        size_t closing = 0;
+        while (end > begin && keyword[end - 1] == ')') {
+            end--;
+            closing++;
+        }
+        if (begin < end) {
+            tokens.push_back(keyword.substr(begin, end - begin));
+        }
+        tokens.insert(tokens.end(), closing, ")");
+    }
+    return tokens;
+}
+
+// Recursive descent over the tokens; pos is the next token and negated tells whether the part is under a negation
+struct BooleanParser {
+    const vector<string>& tokens;
+    size_t pos = 0;
+    vector<string>& keywords;
+    string error;
+
+    bool atOperand() const {
+        return pos < tokens.size() && tokens[pos] != ")" && tokens[pos] != "AND" && tokens[pos] != "OR";
+    }
+
+    // atom := '(' list ')' | keyword
+    bool parseAtom(BooleanNode& node, bool negated) {
+        if (!atOperand() || tokens[pos] == "+" || tokens[pos] == "-" || tokens[pos] == "NOT") {
+            error = pos < tokens.size() ? "unexpected " + tokens[pos] : "missing keyword at the end";
+            return false;
+        }
+        if (tokens[pos] == "(") {
+            pos++;
+            if (!parseList(node, negated)) {
+                return false;
+            }
+            if (pos >= tokens.size() || tokens[pos] != ")") {
+                error = "missing )";
+                return false;
+            }
+            pos++;
+            return true;
+        }
+        node.word = tokens[pos++];
+        if (!negated) {
+            keywords.push_back(node.word);
+        }
+        return true;
+    }
+
+    // Function to read an optional +, - or NOT in front of an operand
+    char parseModifier(char otherwise) {
+        if (pos < tokens.size() && tokens[pos] == "+") {
+            pos++;
+            return '+';
+        }
+        if (pos < tokens.size() && (tokens[pos] == "-" || tokens[pos] == "NOT")) {
+            pos++;
+            return '-';
+        }
+        return otherwise;
+    }
+
+    // clause := [+|-|NOT] atom { AND [+|-|NOT] atom }. A modifier binds to the atom after it; several atoms joined by
+    // AND become a group whose atoms are all required or prohibited, and the group is an optional clause
+    bool parseClause(BooleanNode& node, char& clauseModifier, bool negated) {
+        char modifier = parseModifier(' ');
+        BooleanNode first;
+        if (!parseAtom(first, negated || modifier == '-')) {
+            return false;
+        }
+        if (pos >= tokens.size() || tokens[pos] != "AND") {
+            node = move(first);
+            clauseModifier = modifier;
+            return true;
+        }
+        clauseModifier = ' ';
+        node.children.push_back(move(first));
+        node.modifiers.push_back(modifier == '-' ? '-' : '+');
+        while (pos < tokens.size() && tokens[pos] == "AND") {
+            pos++;
+            char modifier = parseModifier('+');
+            node.children.emplace_back();
+            node.modifiers.push_back(modifier);
+            if (!parseAtom(node.children.back(), negated || modifier == '-')) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // list := { [OR] clause }
+    bool parseList(BooleanNode& node, bool negated) {
+        while (pos < tokens.size() && tokens[pos] != ")") {
+            if (tokens[pos] == "OR") {
+                pos++;
+                continue;
+            }
+            BooleanNode clause;
+            char modifier;
+            if (!parseClause(clause, modifier, negated)) {
+                return false;
+            }
+            node.children.push_back(move(clause));
+            node.modifiers.push_back(modifier);
+        }
+        if (node.children.empty()) {
+            error = "empty query or group";
+            return false;
+        }
+        return true;
+    }
+};
+
+// Function to parse a boolean query; false with a message in error if it is malformed
+bool parseBooleanQuery(const vector<string>& keywords, BooleanQuery& query, string& error) {
+    vector<string> tokens = tokenizeBooleanQuery(keywords);
+    query = BooleanQuery();
+    BooleanParser parser{tokens, 0, query.keywords, ""};
+    if (!parser.parseList(query.root, false) || parser.pos < tokens.size()) {
+        error = parser.error.empty() ? "unexpected )" : parser.error;
+        return false;
+    }
+    return true;
+}
+
+/*
+The set operations work on sorted lists of docIndex - 1. Intersecting a short list with a much longer one gallops:
+each element of the short list is found by doubling steps through the long list and a binary search, so the cost
+grows with the short list only. Lists of similar length are intersected four by four: with SSE2 a block of four
+values of one list is compared with all four rotations of a block of the other, and the block with the smaller
+last value is advanced.
+*/
+const size_t GALLOP_RATIO = 16;         // Gallop when one list is this many times longer than the other
+const size_t PROBE_RATIO = 16;          // Probe a term's compressed postings instead of decoding them above this ratio
+
+// Function to find the first position at or after from where list[position] >= target, by doubling steps
+size_t gallop(const vector<uint32_t>& list, size_t from, uint32_t target) {
+    size_t step = 1;
+    size_t bound = from;
+    while (bound < list.size() && list[bound] < target) {
+        from = bound + 1;
+        bound += step;
+        step *= 2;
+    }
+    return lower_bound(list.begin() + from, list.begin() + min(bound, list.size()), target) - list.begin();
+}
+
+// Function to intersect two sorted lists
+vector<uint32_t> intersectSorted(const vector<uint32_t>& a, const vector<uint32_t>& b) {
+    const vector<uint32_t>& shorter = a.size() <= b.size() ? a : b;
+    const vector<uint32_t>& longer = a.size() <= b.size() ? b : a;
+    vector<uint32_t> result;
+    if (shorter.size() * GALLOP_RATIO < longer.size()) {
+        size_t position = 0;
+        for (uint32_t doc : shorter) {
+            position = gallop(longer, position, doc);
+            if (position == longer.size()) {
+                break;
+            }
+            if (longer[position] == doc) {
+                result.push_back(doc);
+            }
+        }
+        return result;
+    }
+
+    size_t i = 0;
+    size_t j = 0;
+#ifdef __SSE2__
+    while (i + 4 <= a.size() && j + 4 <= b.size()) {
+        __m128i blockA = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a.data() + i));
+        __m128i blockB = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b.data() + j));
+        __m128i equal = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi32(blockA, blockB), _mm_cmpeq_epi32(blockA, _mm_shuffle_epi32(blockB, _MM_SHUFFLE(0, 3, 2, 1)))),
+            _mm_or_si128(_mm_cmpeq_epi32(blockA, _mm_shuffle_epi32(blockB, _MM_SHUFFLE(1, 0, 3, 2))), _mm_cmpeq_epi32(blockA, _mm_shuffle_epi32(blockB, _MM_SHUFFLE(2, 1, 0, 3)))));
+        for (int mask = _mm_movemask_ps(_mm_castsi128_ps(equal)); mask != 0; mask &= mask - 1) {
+            result.push_back(a[i + __builtin_ctz(mask)]);
+        }
+        uint32_t lastA = a[i + 3];
+        uint32_t lastB = b[j + 3];
+        i += lastA <= lastB ? 4 : 0;
+        j += lastB <= lastA ? 4 : 0;
+    }
+#endif
+    while (i < a.size() && j < b.size()) {
+        if (a[i] < b[j]) {
+            i++;
+        } else if (b[j] < a[i]) {
+            j++;
+        } else {
+            result.push_back(a[i]);
+            i++;
+            j++;
+        }
+    }
+    return result;
+}
+
+// Function to remove the elements of a sorted list from another
+vector<uint32_t> subtractSorted(const vector<uint32_t>& a, const vector<uint32_t>& b) {
+    vector<uint32_t> result;
+    size_t position = 0;
+    for (uint32_t doc : a) {
+        position = gallop(b, position, doc);
+        if (position == b.size() || b[position] != doc) {
+            result.push_back(doc);
+        }
+    }
+    return result;
+}
+
+// Function to keep (or, with keep false, drop) the candidates that contain a term, decoding only the blocks that may hold them
+void probeTerm(const InvertedIndex& index, uint32_t id, vector<uint32_t>& candidates, bool keep, size_t& decodedPostings) {
+    size_t kept = 0;
+    size_t c = 0;
+    for (const auto& segment : index.segments) {
+        uint32_t position = findTerm(*segment, id);
+        unique_ptr<PostingCursor> cursor;
+        if (position != NO_TERM) {
+            cursor = make_unique<PostingCursor>(&segment->postings[position]);
+        }
+        for (; c < candidates.size() && candidates[c] < segment->endDoc(); c++) {
+            bool found = false;
+            if (cursor) {
+                cursor->skipTo(candidates[c]);
+                found = !cursor->atEnd() && cursor->doc() == candidates[c];
+            }
+            if (found == keep) {
+                candidates[kept++] = candidates[c];
+            }
+        }
+        if (cursor) {
+            decodedPostings += cursor->decoded;
+        }
+    }
+    candidates.resize(kept);
+}
+
+// Function to list every live document
+vector<uint32_t> liveDocuments(const InvertedIndex& index) {
+    vector<uint32_t> docs;
+    for (const auto& segment : index.segments) {
+        for (uint32_t doc = segment->firstDoc; doc < segment->endDoc(); doc++) {
+            if (!index.deleted[doc]) {
+                docs.push_back(doc);
+            }
+        }
+    }
+    return docs;
+}
+
+/*
+A list of clauses is evaluated from its most selective part. The required clauses are taken shortest first (a
+keyword's length is its document frequency; a group is evaluated to learn its length), and once the candidates
+are few, a long keyword list is not decoded at all: each candidate is looked up through the block headers of the
+compressed postings, so a restrictive query only decodes the blocks its candidates fall in. Prohibited keywords
+are removed the same way.
+*/
+vector<uint32_t> evaluateBoolean(const InvertedIndex& index, const BooleanNode& node, size_t& decodedPostings);
+
+// Function to return a keyword's number of live documents, for ordering the clauses
+size_t keywordLength(const InvertedIndex& index, const string& word) {
+    uint32_t id = lookupTerm(index.vocabulary, word);
+    return id == NO_TERM ? 0 : index.documentFrequency[id];
+}
+
+// Function to narrow the candidates to the documents matching (or, with keep false, not matching) a clause
+void filterClause(const InvertedIndex& index, const BooleanNode& clause, vector<uint32_t>& candidates, bool keep, size_t& decodedPostings) {
+    if (clause.children.empty() && keywordLength(index, clause.word) > PROBE_RATIO * candidates.size()) {
+        probeTerm(index, lookupTerm(index.vocabulary, clause.word), candidates, keep, decodedPostings);
+    } else {
+        vector<uint32_t> matches = evaluateBoolean(index, clause, decodedPostings);
+        candidates = keep ? intersectSorted(candidates, matches) : subtractSorted(candidates, matches);
+    }
+}
+
+// Function to find the documents matching a node, as a sorted list of docIndex - 1, counting the postings it decodes;
+// the caller holds the lock
+vector<uint32_t> evaluateBoolean(const InvertedIndex& index, const BooleanNode& node, size_t& decodedPostings) {
+    if (node.children.empty()) {
+        uint32_t id = lookupTerm(index.vocabulary, node.word);
+        if (id == NO_TERM) {
+            return {};
+        }
+        DecodedPostings decoded;
+        decodePostings(index, id, decoded);
+        decodedPostings += decoded.docs.size();
+        return move(decoded.docs);
+    }
+
+    vector<const BooleanNode*> required;
+    vector<const BooleanNode*> optional;
+    vector<const BooleanNode*> prohibited;
+    for (size_t i = 0; i < node.children.size(); i++) {
+        (node.modifiers[i] == '+' ? required : node.modifiers[i] == '-' ? prohibited : optional).push_back(&node.children[i]);
+    }
+
+    vector<uint32_t> candidates;
+    if (!required.empty()) {
+        // Groups are evaluated up front; keywords are ordered by document frequency
+        vector<pair<size_t, const BooleanNode*>> ordered;
+        vector<vector<uint32_t>> groups;
+        groups.reserve(required.size());
+        for (const BooleanNode* clause : required) {
+            if (clause->children.empty()) {
+                ordered.emplace_back(keywordLength(index, clause->word), clause);
+            } else {
+                groups.push_back(evaluateBoolean(index, *clause, decodedPostings));
+                ordered.emplace_back(groups.back().size(), nullptr);
+            }
+        }
+        vector<size_t> order(ordered.size());
+        for (size_t i = 0; i < order.size(); i++) {
+            order[i] = i;
+        }
+        stable_sort(order.begin(), order.end(), [&ordered](size_t a, size_t b) {
+            return ordered[a].first < ordered[b].first;
+        });
+        vector<size_t> groupOf(ordered.size());
+        for (size_t i = 0, g = 0; i < ordered.size(); i++) {
+            groupOf[i] = ordered[i].second ? SIZE_MAX : g++;
+        }
+
+        bool first = true;
+        for (size_t i : order) {
+            if (first) {
+                candidates = ordered[i].second ? evaluateBoolean(index, *ordered[i].second, decodedPostings) : move(groups[groupOf[i]]);
+                first = false;
+            } else if (ordered[i].second) {
+                filterClause(index, *ordered[i].second, candidates, true, decodedPostings);
+            } else {
+                candidates = intersectSorted(candidates, groups[groupOf[i]]);
+            }
+            if (candidates.empty()) {
+                return candidates;
+            }
+        }
+    } else if (!optional.empty()) {
+        for (const BooleanNode* clause : optional) {
+            vector<uint32_t> matches = evaluateBoolean(index, *clause, decodedPostings);
+            vector<uint32_t> merged;
+            merged.reserve(candidates.size() + matches.size());
+            set_union(candidates.begin(), candidates.end(), matches.begin(), matches.end(), back_inserter(merged));
+            candidates.swap(merged);
+        }
+    } else {
+        candidates = liveDocuments(index);
+    }
+
+    for (const BooleanNode* clause : prohibited) {
+        if (candidates.empty()) {
+            break;
+        }
+        filterClause(index, *clause, candidates, false, decodedPostings);
+    }
+    return candidates;
+}
+
+// Function to rank the documents matching a boolean query by TF-IDF over its scored keywords, adding the number of
+// postings decoded to decodedPostings if it is given; the caller holds the lock
+vector<pair<double, pair<int, string>>> searchBooleanLocked(const InvertedIndex& index, const BooleanQuery& query, size_t k, const CorpusStats* global = nullptr, size_t* decodedPostings = nullptr) {
+    TopK top(k);
+    vector<QueryTerm> queryTerms;
+    vector<int> keywordSlots;
+    planQuery(index, query.keywords, queryTerms, keywordSlots, global);
+    if (k == 0 || queryTerms.empty()) {
+        return {};
+    }
+    size_t decoded = 0;
+    vector<uint32_t> matches = evaluateBoolean(index, query.root, decoded);
+
+    // The counts of the scored terms are looked up per matching document, segment by segment
+    size_t m = 0;
+    vector<uint32_t> counts(queryTerms.size());
+    for (const auto& segment : index.segments) {
+        if (m == matches.size() || matches[m] >= segment->endDoc()) {
+            continue;
+        }
+        vector<unique_ptr<PostingCursor>> cursors(queryTerms.size());
+        for (size_t q = 0; q < queryTerms.size(); q++) {
+            uint32_t position = findTerm(*segment, queryTerms[q].id);
+            if (position != NO_TERM) {
+                cursors[q] = make_unique<PostingCursor>(&segment->postings[position]);
+            }
+        }
+        for (; m < matches.size() && matches[m] < segment->endDoc(); m++) {
+            uint32_t doc = matches[m];
+            for (size_t q = 0; q < queryTerms.size(); q++) {
+                counts[q] = 0;
+                if (cursors[q]) {
+                    cursors[q]->skipTo(doc);
+                    if (!cursors[q]->atEnd() && cursors[q]->doc() == doc) {
+                        counts[q] = cursors[q]->count();
+                    }
+                }
+            }
+
+            // Exact score, accumulated in keyword order like the full scan
+            double score = 0.0;
+            for (int slot : keywordSlots) {
+                if (slot >= 0 && counts[slot] > 0) {
+                    score += termFrequency(counts[slot], segment->docLengths[doc - segment->firstDoc]) * queryTerms[slot].idf;
+                }
+            }
+            if (score > 0) {
+                top.push(score, doc + 1);
+            }
+        }
+        for (const auto& cursor : cursors) {
+            decoded += cursor ? cursor->decoded : 0;
+        }
+    }
+    if (decodedPostings != nullptr) {
+        *decodedPostings += decoded;
+    }
+    return rankedResults(top, index);
+}
+
+// Function to return the top k documents matching a boolean query, best first
+vector<pair<double, pair<int, string>>> searchBoolean(const InvertedIndex& index, const BooleanQuery& query, size_t k, const CorpusStats* global = nullptr, size_t* decodedPostings = nullptr) {
+    shared_lock<shared_mutex> lock(index.lock);
+    return searchBooleanLocked(index, query, k, global, decodedPostings);
+}
+
+// Function to answer every valid query of a batch; returns the number of postings decoded
+size_t searchBatch(const InvertedIndex& index, vector<BatchQuery>& queries) {
+    shared_lock<shared_mutex> lock(index.lock);
+    size_t decodedPostings = 0;
+
+    vector<uint32_t> docLengths(index.deleted.size());
+    for (const auto& segment : index.segments) {
+        copy(segment->docLengths.begin(), segment->docLengths.end(), docLengths.begin() + segment->firstDoc);
+    }
+
+    // Union-find over the queries: two queries are in the same group if they share a term
+    vector<size_t> parent(queries.size());
+    unordered_map<uint32_t, size_t> firstQuery;         // term ID -> first query using it
+    auto findGroup = [&parent](size_t q) {
+        while (parent[q] != q) {
+            q = parent[q] = parent[parent[q]];
+        }
+        return q;
+    };
+    for (size_t q = 0; q < queries.size(); q++) {
+        parent[q] = q;
+        if (queries[q].numResults <= 0) {
+            continue;
+        }
+        vector<string> keywords;
+        stringstream line(queries[q].line);
+        string keyword;
+        line >> keyword;            // NUM
+        while (line >> keyword) {
+            keywords.push_back(keyword);
+        }
+        // Boolean queries are answered on their own
+        if (isBooleanQuery(keywords)) {
+            BooleanQuery booleanQuery;
+            if (parseBooleanQuery(keywords, booleanQuery, queries[q].error)) {
+                queries[q].results = searchBooleanLocked(index, booleanQuery, queries[q].numResults, nullptr, &decodedPostings);
+            } else {
+                queries[q].numResults = -1;
+            }
+            continue;
+        }
+        planQuery(index, keywords, queries[q].queryTerms, queries[q].keywordSlots);
+        for (const auto& term : queries[q].queryTerms) {
+            auto inserted = firstQuery.emplace(term.id, q);
+            if (!inserted.second) {
+                parent[findGroup(q)] = findGroup(inserted.first->second);
+            }
+        }
+    }
+    unordered_map<size_t, vector<size_t>> groups;       // group root -> queries, in file order
+    vector<size_t> roots;
+    for (size_t q = 0; q < queries.size(); q++) {
+        if (queries[q].numResults > 0 && !queries[q].queryTerms.empty()) {
+            auto& members = groups[findGroup(q)];
+            if (members.empty()) {
+                roots.push_back(findGroup(q));
+            }
+            members.push_back(q);
+        }
+    }
+
+    unordered_map<uint32_t, DecodedPostings> decoded;
+    for (size_t root : roots) {
+        decoded.clear();
+        for (size_t q : groups[root]) {
+            for (const auto& term : queries[q].queryTerms) {
+                auto inserted = decoded.emplace(term.id, DecodedPostings());
+                if (inserted.second) {
+                    decodePostings(index, term.id, inserted.first->second);
+                    decodedPostings += inserted.first->second.docs.size();
+                }
+            }
+        }
+        for (size_t q : groups[root]) {
+            vector<const DecodedPostings*> lists;
+            for (const auto& term : queries[q].queryTerms) {
+                lists.push_back(&decoded[term.id]);
+            }
+            scoreDecoded(queries[q], lists, docLengths, index);
+        }
+    }
+    return decodedPostings;
+}
+
+// Function to write the top count results, one "score docIndex docID" line each
+void writeResults(ostream& out, const vector<pair<double, pair<int, string>>>& scores, int count) {
+    for (int i = 0; i < min(count, static_cast<int>(scores.size())); i++) {
+        out << fixed << setprecision(6) << scores[i].first << " " << scores[i].second.first << " " << scores[i].second.second << endl;
+    }
+}
+
+/*
+Function to read the dictionary, stopwords and articles and build the in-memory inverted index. With numShards > 1
+only shard number shard of numShards consecutive, nearly equal docIndex ranges is indexed; its documents keep
+their docIndex in the whole corpus, and the documents of the other shards are only counted.
+*/
+bool loadCorpus(const string& dictionaryFile, const string& stopwordsFile, const string& articleFile, InvertedIndex& index, ostream& log, Profiler& profiler, uint32_t shard = 0, uint32_t numShards = 1) {
+    beginStage(profiler);
+    unordered_set<string> dictionary;
+    readWords(dictionaryFile, dictionary);
+    endStage(profiler, "load dictionary", fileSize(dictionaryFile), 0, dictionary.size());
+    beginStage(profiler);
+    unordered_set<string> stopwords;
+    readWords(stopwordsFile, stopwords);
+    endStage(profiler, "load stopwords", fileSize(stopwordsFile), 0, stopwords.size());
+    log << "Dictionary contains " << dictionary.size() << " words." << endl;
+    log << "Stopwords contains " << stopwords.size() << " words." << endl;
+    Vocabulary vocabulary = buildVocabulary(dictionary, stopwords);
+
+    // Each document's term table goes straight into the compressed posting lists of the first segment,
+    // and the document text is dropped as soon as it has been counted. Reading the articles, preprocessing and
+    // counting TF are one streamed stage.
+    beginStage(profiler);
+    size_t firstDoc = 0;
+    size_t endDoc = SIZE_MAX;
+    if (numShards > 1) {
+        // A first pass counts the documents to find this shard's range
+        size_t totalDocs;
+        if (!streamArticles(articleFile, [](string_view, string_view) {}, totalDocs)) {
+            return false;
+        }
+        firstDoc = totalDocs * shard / numShards;
+        endDoc = totalDocs * (shard + 1) / numShards;
+    }
+
+    startIndex(index, move(vocabulary));
+    TermCounter counter(index.vocabulary.terms.size(), index.filter.maxLength);
+    SegmentBuilder builder;
+    startSegment(builder, index.vocabulary.terms.size(), static_cast<uint32_t>(firstDoc));
+    vector<pair<uint32_t, uint32_t>> tf;
+    size_t numDocs;
+    size_t doc = 0;
+    uint64_t tokens = 0;
+    bool opened = streamArticles(articleFile, [&](string_view docID, string_view content) {
+        if (doc >= firstDoc && doc < endDoc) {
+            uint32_t docLength = preProcessText(content, index.filter, counter, tf);
+            addDocument(builder, docID, docLength, tf);
+            tokens += docLength;
+        }
+        doc++;
+    }, numDocs);
+    if (!opened) {
+        return false;
+    }
+    if (numShards > 1) {
+        log << "Processed " << numDocs << " documents, indexing docIndex " << firstDoc + 1 << " to " << min(endDoc, numDocs)
+            << " as shard " << shard + 1 << " of " << numShards << "." << endl;
+    } else {
+        log << "Processed " << numDocs << " documents." << endl;
+    }
+    appendSegment(index, finishSegment(builder));
+    endStage(profiler, "preprocess", fileSize(articleFile), index.liveDocuments, tokens);
+    return true;
+}
+
+/*
+Server traffic repeats the same keyword sets over and over, so the server keeps the ranked answers of recent
+queries in an LRU cache. The key is the multiset of the query's known keywords (as sorted term IDs; words outside the
+vocabulary never change a score), so "edu news" and "news edu" share an entry. An entry computed for K results
+also answers any smaller NUM, since the top NUM is a prefix of the top K, and any NUM at all once it holds every
+matching document. Every entry records the corpus version it was computed for; adding or deleting documents
+bumps the version, so stale answers are never served. Merging segments does not change any answer and leaves the
+version alone.
+Scores are sums in keyword order, so when a hit comes from the same keywords in a different order, the cached
+documents are rescored in the new order before being served, and the printed scores stay those of a fresh search.
+*/
+struct CachedAnswer {
+    string key;
+    vector<uint32_t> keywordIds;                                // Keywords the answer was computed for, in order
+    size_t k;                                                   // Number of results asked for
+    uint64_t version;
+    vector<pair<double, pair<int, string>>> results;
+    size_t bytes;
+};
+
+struct ResultCache {
+    size_t capacityBytes = 0;                                   // 0 disables the cache
+    size_t bytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    list<CachedAnswer> entries;                                 // Most recently used first
+    unordered_map<string, list<CachedAnswer>::iterator> lookup;
+};
+
+// Function to estimate the memory held by a cached answer
+size_t cachedBytes(const CachedAnswer& entry) {
+    size_t bytes = sizeof(CachedAnswer) + 2 * entry.key.size() + entry.keywordIds.size() * sizeof(uint32_t) + 64;
+    for (const auto& result : entry.results) {
+        bytes += sizeof(result) + result.second.second.capacity();
+    }
+    return bytes;
+}
+
+// Function to drop the least recently used answers until the cache fits in its capacity
+void evictAnswers(ResultCache& cache) {
+    while (cache.bytes > cache.capacityBytes && !cache.entries.empty()) {
+        cache.bytes -= cache.entries.back().bytes;
+        cache.lookup.erase(cache.entries.back().key);
+        cache.entries.pop_back();
+    }
+}
+
+// Function to rescore cached results for keywords in a different order, and rank them again
+void rescoreResults(const InvertedIndex& index, const vector<string>& keywords, vector<pair<double, pair<int, string>>>& results) {
+    shared_lock<shared_mutex> lock(index.lock);
+    vector<QueryTerm> queryTerms;
+    vector<int> keywordSlots;
+    planQuery(index, keywords, queryTerms, keywordSlots);
+
+    vector<uint32_t> counts(queryTerms.size());
+    for (auto& result : results) {
+        uint32_t doc = result.second.first - 1;
+        auto it = upper_bound(index.segments.begin(), index.segments.end(), doc, [](uint32_t d, const shared_ptr<const Segment>& segment) {
+            return d < segment->firstDoc;
+        });
+        const Segment& segment = **(it - 1);
+        for (size_t q = 0; q < queryTerms.size(); q++) {
+            counts[q] = 0;
+            uint32_t position = findTerm(segment, queryTerms[q].id);
+            if (position != NO_TERM) {
+                PostingCursor cursor(&segment.postings[position]);
+                cursor.skipTo(doc);
+                if (!cursor.atEnd() && cursor.doc() == doc) {
+                    counts[q] = cursor.count();
+                }
+            }
+        }
+
+        // Exact score, accumulated in keyword order like the full scan
+        double score = 0.0;
+        for (int slot : keywordSlots) {
+            if (slot >= 0 && counts[slot] > 0) {
+                score += termFrequency(counts[slot], segment.docLengths[doc - segment.firstDoc]) * queryTerms[slot].idf;
+            }
+        }
+        result.first = score;
+    }
+    sort(results.begin(), results.end(), [](const pair<double, pair<int, string>>& a, const pair<double, pair<int, string>>& b) {
+        return ranksBefore(make_pair(a.first, a.second.first), make_pair(b.first, b.second.first));
+    });
+}
+
+// Function to answer a query from the cache when possible, and to cache the answer otherwise
+vector<pair<double, pair<int, string>>> searchCached(const InvertedIndex& index, ResultCache& cache, const vector<string>& keywords, size_t k) {
+    if (cache.capacityBytes == 0) {
+        return searchIndex(index, keywords, k);
+    }
+
+    vector<uint32_t> keywordIds;
+    uint64_t version;
+    {
+        shared_lock<shared_mutex> lock(index.lock);
+        for (uint32_t id : lookupKeywords(index.vocabulary, keywords)) {
+            if (id != NO_TERM) {
+                keywordIds.push_back(id);
+            }
+        }
+        version = index.version;
+    }
+    vector<uint32_t> sortedIds(keywordIds);
+    sort(sortedIds.begin(), sortedIds.end());
+    string key(reinterpret_cast<const char*>(sortedIds.data()), sortedIds.size() * sizeof(uint32_t));
+
+    auto found = cache.lookup.find(key);
+    if (found != cache.lookup.end()) {
+        CachedAnswer& entry = *found->second;
+        bool complete = entry.results.size() < entry.k;
+        if (entry.version == version && (entry.k >= k || complete)) {
+            cache.hits++;
+            cache.entries.splice(cache.entries.begin(), cache.entries, found->second);
+            vector<pair<double, pair<int, string>>> results(entry.results);
+            if (entry.keywordIds != keywordIds) {
+                rescoreResults(index, keywords, results);
+            }
+            results.resize(min(results.size(), k));
+            return results;
+        }
+        cache.bytes -= entry.bytes;
+        cache.entries.erase(found->second);
+        cache.lookup.erase(found);
+    }
+
+    cache.misses++;
+    vector<pair<double, pair<int, string>>> results = searchIndex(index, keywords, k);
+    CachedAnswer entry{key, keywordIds, k, version, results, 0};
+    entry.bytes = cachedBytes(entry);
+    if (entry.bytes <= cache.capacityBytes) {
+        cache.entries.push_front(move(entry));
+        cache.lookup.emplace(key, cache.entries.begin());
+        cache.bytes += cache.entries.front().bytes;
+        evictAnswers(cache);
+    }
+    return results;
+}
+
+/*
+Server mode answers one request per line. A query line has the same form as the command line, "NUM keyword1 ... keywordN".
+Every answer echoes the query, lists the top NUM results in the results.txt format, reports the time spent on that
+query alone and ends with an empty line so a client knows where one answer stops.
+The corpus can also be changed without restarting the server:
+    ADD FILE        adds the form-feed-delimited documents of FILE; they are numbered after the existing documents
+    DELETE DOCID    deletes every document with that ID; the other documents keep their docIndex
+    STATS           reports the number of documents, terms and segments, and the hits, misses and size of the cache
+A shard worker also answers the two requests a coordinator sends for every query (see searchShards):
+    DF keyword1 ... keywordN
+                    reports the number of live documents and the document frequency of each keyword
+    SEARCH NUM DOCUMENTS N DF1 ... DFN keyword1 ... keywordM
+                    lists the top NUM results with IDF computed from the given totals, with exact scores; the N
+                    DFs belong to the scored keywords (for a boolean query, those that are not negated)
+*/
+string answerCommand(InvertedIndex& index, ResultCache& cache, const string& command, stringstream& request, stringstream& answer) {
+    string argument;
+    getline(request >> ws, argument);
+    auto start = high_resolution_clock::now(); // Start timing
+
+    if (command == "ADD" && !argument.empty() && index.numShards > 1) {
+        answer << "Error: a shard cannot add documents\n\n";
+        return answer.str();
+    } else if (command == "ADD" && !argument.empty()) {
+        uint32_t firstDoc = 0;
+        uint32_t added = 0;
+        if (!addDocuments(index, argument, firstDoc, added)) {
+            answer << "Error: unable to open file " << argument << "\n\n";
+            return answer.str();
+        }
+        answer << "Added " << added << " documents";
+        if (added > 0) {
+            answer << " as docIndex " << firstDoc + 1 << " to " << firstDoc + added;
+        }
+    } else if (command == "DELETE" && !argument.empty()) {
+        answer << "Deleted " << deleteDocuments(index, argument) << " documents";
+    } else if (command == "DF") {
+        stringstream words(argument);
+        vector<string> keywords;
+        string keyword;
+        while (words >> keyword) {
+            keywords.push_back(keyword);
+        }
+        shared_lock<shared_mutex> lock(index.lock);
+        answer << "Documents: " << index.liveDocuments << " DF:";
+        for (uint32_t id : lookupKeywords(index.vocabulary, keywords)) {
+            answer << " " << (id == NO_TERM ? 0 : index.documentFrequency[id]);
+        }
+    } else if (command == "SEARCH") {
+        stringstream words(argument);
+        size_t numResults;
+        size_t numScored;
+        CorpusStats global;
+        if (!(words >> numResults >> global.documents >> numScored) || numScored > argument.size()) {
+            answer << "Error: expected SEARCH NUM DOCUMENTS N DF1 ... DFN keyword1 ... keywordM\n\n";
+            return answer.str();
+        }
+        global.keywordDF.resize(numScored);
+        for (auto& df : global.keywordDF) {
+            words >> df;
+        }
+        vector<string> keywords;
+        string keyword;
+        while (words >> keyword) {
+            keywords.push_back(keyword);
+        }
+
+        // The DFs belong to the scored keywords: all of them, or those of a boolean query that are not negated
+        BooleanQuery booleanQuery;
+        string error;
+        bool boolean = isBooleanQuery(keywords);
+        if (!words.eof() || (boolean && !parseBooleanQuery(keywords, booleanQuery, error))
+            || numScored != (boolean ? booleanQuery.keywords.size() : keywords.size())) {
+            answer << "Error: " << (error.empty() ? "expected SEARCH NUM DOCUMENTS N DF1 ... DFN keyword1 ... keywordM" : error) << "\n\n";
+            return answer.str();
+        }
+
+        // 17 significant digits give back the exact double, so the coordinator ranks exactly like a single index
+        vector<pair<double, pair<int, string>>> scores = boolean ? searchBoolean(index, booleanQuery, numResults, &global) : searchIndex(index, keywords, numResults, &global);
+        for (const auto& score : scores) {
+            answer << defaultfloat << setprecision(17) << score.first << " " << score.second.first << " " << score.second.second << "\n";
+        }
+        answer << "Results: " << scores.size();
+    } else if (command == "STATS" && argument.empty()) {
+        shared_lock<shared_mutex> lock(index.lock);
+        size_t heldDocuments = index.segments.empty() ? 0 : index.deleted.size() - index.segments.front()->firstDoc;
+        answer << "Documents: " << index.liveDocuments << " (" << heldDocuments - index.liveDocuments << " deleted)"
+               << " Terms: " << countIndexedTerms(index) << " Segments: " << index.segments.size()
+               << " Cache: " << cache.hits << " hits " << cache.misses << " misses " << cache.entries.size() << " entries "
+               << cache.bytes << " bytes";
+    } else {
+        answer << "Error: expected NUM keyword1 keyword2 ... keywordN, ADD FILE, DELETE DOCID or STATS\n\n";
+        return answer.str();
+    }
+
+    auto end = high_resolution_clock::now(); // End timing
+    answer << " Time taken: " << duration_cast<microseconds>(end - start).count() << " microseconds\n\n";
+    return answer.str();
+}
+
+string answerQuery(InvertedIndex& index, ResultCache& cache, const string& line) {
+    stringstream query(line);
+    stringstream answer;
+
+    string command;
+    query >> command;
+    if (command == "ADD" || command == "DELETE" || command == "STATS" || command == "DF" || command == "SEARCH") {
+        answer << "Command: " << line << "\n";
+        return answerCommand(index, cache, command, query, answer);
+    }
+    answer << "Query: " << line << "\n";
+    query.clear();
+    query.seekg(0);
+
+    int numResults;
+    if (!(query >> numResults) || numResults < 0) {
+        answer << "Error: expected NUM keyword1 keyword2 ... keywordN, ADD FILE, DELETE DOCID or STATS\n\n";
+        return answer.str();
+    }
+
+    vector<string> keywords;
+    string keyword;
+    while (query >> keyword) {
+        keywords.push_back(keyword);
+    }
+
+    auto start = high_resolution_clock::now(); // Start timing
+
+    // Boolean queries are not cached; their keyword multiset does not identify them
+    vector<pair<double, pair<int, string>>> scores;
+    if (isBooleanQuery(keywords)) {
+        BooleanQuery booleanQuery;
+        string error;
+        if (!parseBooleanQuery(keywords, booleanQuery, error)) {
+            answer << "Error: " << error << "\n\n";
+            return answer.str();
+        }
+        scores = searchBoolean(index, booleanQuery, numResults);
+    } else {
+        scores = searchCached(index, cache, keywords, numResults);
+    }
+
+    auto end = high_resolution_clock::now(); // End timing
+
+    writeResults(answer, scores, numResults);
+    answer << "Results: " << min(numResults, static_cast<int>(scores.size()))
+           << " Time taken: " << duration_cast<microseconds>(end - start).count() << " microseconds\n\n";
+    return answer.str();
+}
+
+// Function to answer queries read line by line from a stream until end of input
+void serveStream(istream& in, ostream& out, const function<string(const string&)>& answerLine) {
+    string line;
+    while (getline(in, line)) {
+        if (line.find_first_not_of(" \t\r") == string::npos) {
+            continue;
+        }
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        out << answerLine(line) << flush;
+    }
+}
+
+#ifndef _WIN32
+// Function to write a whole buffer to a socket, retrying short writes
+bool sendAll(int fd, const string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = write(fd, data.data() + sent, data.size() - sent);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+/*
+A socket address is either HOST:PORT for TCP (an empty HOST listens on every interface) or the path of a Unix
+domain socket. Requests and answers are small, so Nagle's algorithm is turned off on TCP connections; otherwise
+every answer could wait for a delayed acknowledgement.
+*/
+bool isTCPAddress(const string& address) {
+    return address.find(':') != string::npos && address.find('/') == string::npos;
+}
+
+// Function to resolve a TCP address; the caller frees the result with freeaddrinfo
+addrinfo* resolveTCPAddress(const string& address, bool passive) {
+    size_t colon = address.rfind(':');
+    string host = address.substr(0, colon);
+    string port = address.substr(colon + 1);
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = passive ? AI_PASSIVE : 0;
+    addrinfo* found = nullptr;
+    if (getaddrinfo(host.empty() ? nullptr : host.c_str(), port.c_str(), &hints, &found) != 0) {
+        return nullptr;
+    }
+    return found;
+}
+
+// Function to fill in the address of a Unix domain socket; false if the path is too long
+bool unixAddress(const string& path, sockaddr_un& address) {
+    if (path.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    address = sockaddr_un{};
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    return true;
+}
+
+// Function to turn off Nagle's algorithm on a TCP connection
+void setNoDelay(int fd) {
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+}
+
+// Function to open a listening socket on an address, or return -1
+int listenOn(const string& address) {
+    if (isTCPAddress(address)) {
+        addrinfo* found = resolveTCPAddress(address, true);
+        for (addrinfo* candidate = found; candidate != nullptr; candidate = candidate->ai_next) {
+            int server = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+            if (server < 0) {
+                continue;
+            }
+            int on = 1;
+            setsockopt(server, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if (bind(server, candidate->ai_addr, candidate->ai_addrlen) == 0 && listen(server, 16) == 0) {
+                freeaddrinfo(found);
+                return server;
+            }
+            close(server);
+        }
+        if (found != nullptr) {
+            freeaddrinfo(found);
+        }
+        return -1;
+    }
+
+    sockaddr_un unixSocket;
+    if (!unixAddress(address, unixSocket)) {
+        return -1;
+    }
+    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server < 0) {
+        return -1;
+    }
+    unlink(address.c_str());
+    if (bind(server, reinterpret_cast<sockaddr*>(&unixSocket), sizeof(unixSocket)) != 0 || listen(server, 16) != 0) {
+        close(server);
+        return -1;
+    }
+    return server;
+}
+
+// Function to connect to a listening socket, or return -1
+int connectTo(const string& address) {
+    if (isTCPAddress(address)) {
+        addrinfo* found = resolveTCPAddress(address, false);
+        for (addrinfo* candidate = found; candidate != nullptr; candidate = candidate->ai_next) {
+            int fd = socket(candidate->ai_family, candidate->ai_socktype, candidate->ai_protocol);
+            if (fd < 0) {
+                continue;
+            }
+            if (connect(fd, candidate->ai_addr, candidate->ai_addrlen) == 0) {
+                freeaddrinfo(found);
+                setNoDelay(fd);
+                return fd;
+            }
+            close(fd);
+        }
+        if (found != nullptr) {
+            freeaddrinfo(found);
+        }
+        return -1;
+    }
+
+    sockaddr_un unixSocket;
+    if (!unixAddress(address, unixSocket)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&unixSocket), sizeof(unixSocket)) != 0) {
+        close(fd);
+        fd = -1;
+    }
+    return fd;
+}
+
+// Function to answer queries from clients connecting to a socket, one connection at a time
+bool serveSocket(const string& address, const function<string(const string&)>& answerLine) {
+    int server = listenOn(address);
+    if (server < 0) {
+        cerr << "Unable to listen on socket " << address << endl;
+        return false;
+    }
+
+    // A client hanging up mid-answer must not kill the server
+    signal(SIGPIPE, SIG_IGN);
+
+    while (true) {
+        int client = accept(server, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        if (isTCPAddress(address)) {
+            setNoDelay(client);
+        }
+
+        string pending;
+        char buffer[4096];
+        bool open = true;
+        while (open) {
+            ssize_t n = read(client, buffer, sizeof(buffer));
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                break;
+            }
+            pending.append(buffer, n);
+
+            size_t lineEnd;
+            while (open && (lineEnd = pending.find('\n')) != string::npos) {
+                string line = pending.substr(0, lineEnd);
+                pending.erase(0, lineEnd + 1);
+                if (!line.empty() && line.back() == '\r') {
+                    line.pop_back();
+                }
+                if (line.find_first_not_of(" \t") != string::npos) {
+                    open = sendAll(client, answerLine(line));
+                }
+            }
+        }
+        close(client);
+    }
+
+    close(server);
+    if (!isTCPAddress(address)) {
+        unlink(address.c_str());
+    }
+    return true;
+}
+
+/*
+A corpus too large for one process is split into shards: worker processes that each index one docIndex range
+(search --shard I/N --socket ADDRESS) and a coordinator (search --shards ...) that answers queries by asking all of
+them. IDF depends on the whole corpus, so a query takes two rounds. First the coordinator sends DF with the
+keywords to every shard and adds up their live documents and document frequencies. Then it sends SEARCH with
+those totals, and every shard returns its top NUM scored with the global IDF. TF only depends on the document
+itself, so a shard computes exactly the score a single index over the whole corpus would, and scores travel with
+17 significant digits so nothing is rounded. Merging the shards' lists by score and docIndex then gives exactly the
+single-process ranking. Each round is sent to all shards before any answer is read, so the shards work in parallel.
+*/
+struct ShardConnection {
+    string address;
+    int fd = -1;
+    string pending;                     // Bytes received after the last complete answer
+};
+
+// Function to read one answer from a shard; answers end with an empty line
+bool readAnswer(ShardConnection& shard, string& answer) {
+    char buffer[4096];
+    size_t end;
+    while ((end = shard.pending.find("\n\n")) == string::npos) {
+        ssize_t n = read(shard.fd, buffer, sizeof(buffer));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        shard.pending.append(buffer, n);
+    }
+    answer = shard.pending.substr(0, end + 1);
+    shard.pending.erase(0, end + 2);
+    return true;
+}
+
+// Function to send a request to every shard and collect the answers in shard order, without their echo lines
+bool askShards(vector<ShardConnection>& shards, const string& request, vector<string>& answers, string& error) {
+    for (auto& shard : shards) {
+        if (!sendAll(shard.fd, request + "\n")) {
+            error = "shard " + shard.address + " is not responding";
+            return false;
+        }
+    }
+    answers.assign(shards.size(), string());
+    for (size_t i = 0; i < shards.size(); i++) {
+        if (!readAnswer(shards[i], answers[i])) {
+            error = "shard " + shards[i].address + " is not responding";
+            return false;
+        }
+        answers[i].erase(0, answers[i].find('\n') + 1);
+        if (answers[i].compare(0, 6, "Error:") == 0) {
+            error = "shard " + shards[i].address + " answered " + answers[i].substr(0, answers[i].find('\n'));
+            return false;
+        }
+    }
+    return true;
+}
+
+// Function to return the top k documents of the whole sharded corpus, best first
+bool searchShards(vector<ShardConnection>& shards, const vector<string>& keywords, size_t k, vector<pair<double, pair<int, string>>>& results, string& error) {
+    string words;
+    for (const auto& keyword : keywords) {
+        words += " " + keyword;
+    }
+    vector<string> scored = keywords;
+    if (isBooleanQuery(keywords)) {
+        BooleanQuery booleanQuery;
+        if (!parseBooleanQuery(keywords, booleanQuery, error)) {
+            return false;
+        }
+        scored = booleanQuery.keywords;
+    }
+
+    // Round one: the number of live documents and the document frequencies of the scored keywords over all shards
+    string request = "DF";
+    for (const auto& keyword : scored) {
+        request += " " + keyword;
+    }
+    vector<string> answers;
+    if (!askShards(shards, request, answers, error)) {
+        return false;
+    }
+    CorpusStats global;
+    global.keywordDF.assign(scored.size(), 0);
+    for (const auto& text : answers) {
+        stringstream answer(text);
+        string label;
+        uint64_t documents;
+        answer >> label >> documents >> label;
+        global.documents += documents;
+        for (auto& df : global.keywordDF) {
+            uint64_t shardDF;
+            answer >> shardDF;
+            df += shardDF;
+        }
+    }
+
+    // Round two: every shard's top k under the global IDF; the last line of an answer is its "Results:" line
+    request = "SEARCH " + to_string(k) + " " + to_string(global.documents) + " " + to_string(scored.size());
+    for (uint64_t df : global.keywordDF) {
+        request += " " + to_string(df);
+    }
+    if (!askShards(shards, request + words, answers, error)) {
+        return false;
+    }
+    results.clear();
+    for (const auto& text : answers) {
+        size_t lineStart = 0;
+        size_t lineEnd;
+        while ((lineEnd = text.find('\n', lineStart)) != string::npos && lineEnd + 1 < text.size()) {
+            string line = text.substr(lineStart, lineEnd - lineStart);
+            lineStart = lineEnd + 1;
+            char* rest;
+            double score = strtod(line.c_str(), &rest);
+            int docIndex = static_cast<int>(strtol(rest, &rest, 10));
+            results.emplace_back(score, make_pair(docIndex, string(rest + (*rest == ' ' ? 1 : 0))));
+        }
+    }
+
+    sort(results.begin(), results.end(), [](const pair<double, pair<int, string>>& a, const pair<double, pair<int, string>>& b) {
+        return ranksBefore(make_pair(a.first, a.second.first), make_pair(b.first, b.second.first));
+    });
+    results.resize(min(results.size(), k));
+    return true;
+}
+
+// Function to answer a request line for a sharded corpus, in the same form as answerQuery
+string answerShardedQuery(vector<ShardConnection>& shards, const string& line) {
+    stringstream query(line);
+    stringstream answer;
+
+    string command;
+    query >> command;
+    if (command == "ADD" || command == "DELETE" || command == "STATS") {
+        answer << "Command: " << line << "\n";
+        if (command == "ADD") {
+            answer << "Error: a sharded corpus cannot add documents\n\n";
+            return answer.str();
+        }
+
+        // Every shard answers for its own documents
+        auto start = high_resolution_clock::now(); // Start timing
+        vector<string> answers;
+        string error;
+        if (!askShards(shards, line, answers, error)) {
+            answer << "Error: " << error << "\n\n";
+            return answer.str();
+        }
+        auto end = high_resolution_clock::now(); // End timing
+        for (size_t i = 0; i < answers.size(); i++) {
+            answer << "Shard " << i + 1 << ": " << answers[i];
+        }
+        answer << "Shards: " << shards.size() << " Time taken: " << duration_cast<microseconds>(end - start).count() << " microseconds\n\n";
+        return answer.str();
+    }
+    answer << "Query: " << line << "\n";
+    query.clear();
+    query.seekg(0);
+
+    int numResults;
+    if (!(query >> numResults) || numResults < 0) {
+        answer << "Error: expected NUM keyword1 keyword2 ... keywordN, DELETE DOCID or STATS\n\n";
+        return answer.str();
+    }
+
+    vector<string> keywords;
+    string keyword;
+    while (query >> keyword) {
+        keywords.push_back(keyword);
+    }
+
+    auto start = high_resolution_clock::now(); // Start timing
+
+    vector<pair<double, pair<int, string>>> scores;
+    string error;
+    if (!searchShards(shards, keywords, numResults, scores, error)) {
+        answer << "Error: " << error << "\n\n";
+        return answer.str();
+    }
+
+    auto end = high_resolution_clock::now(); // End timing
+
+    writeResults(answer, scores, numResults);
+    answer << "Results: " << min(numResults, static_cast<int>(scores.size()))
+           << " Time taken: " << duration_cast<microseconds>(end - start).count() << " microseconds\n\n";
+    return answer.str();
+}
+
+// Function to start numShards local shard workers running program, each listening on its own Unix domain socket
+bool startLocalShards(const char* program, uint32_t numShards, vector<string>& addresses, vector<pid_t>& workers) {
+    for (uint32_t i = 0; i < numShards; i++) {
+        string address = "/tmp/search-" + to_string(getpid()) + "-shard" + to_string(i + 1) + ".sock";
+        string shard = to_string(i + 1) + "/" + to_string(numShards);
+        pid_t pid = fork();
+        if (pid < 0) {
+            cerr << "Unable to start shard " << shard << endl;
+            return false;
+        }
+        if (pid == 0) {
+            execlp(program, program, "--shard", shard.c_str(), "--socket", address.c_str(), static_cast<char*>(nullptr));
+            _exit(127);
+        }
+        addresses.push_back(address);
+        workers.push_back(pid);
+    }
+    return true;
+}
+
+// Function to stop the local shard workers and remove their sockets
+void stopLocalShards(const vector<string>& addresses, const vector<pid_t>& workers) {
+    for (pid_t pid : workers) {
+        kill(pid, SIGTERM);
+    }
+    for (size_t i = 0; i < workers.size(); i++) {
+        waitpid(workers[i], nullptr, 0);
+        unlink(addresses[i].c_str());
+    }
+}
+
+// Function to connect to every shard; a local worker is waited for until it has loaded its shard and listens
+bool connectShards(const vector<string>& addresses, const vector<pid_t>& workers, vector<ShardConnection>& shards) {
+    signal(SIGPIPE, SIG_IGN);
+    for (size_t i = 0; i < addresses.size(); i++) {
+        ShardConnection shard;
+        shard.address = addresses[i];
+        while ((shard.fd = connectTo(shard.address)) < 0) {
+            if (i >= workers.size() || waitpid(workers[i], nullptr, WNOHANG) != 0) {
+                cerr << "Unable to connect to shard " << shard.address << endl;
+                return false;
+            }
+            this_thread::sleep_for(milliseconds(20));
+        }
+        shards.push_back(move(shard));
+    }
+    return true;
+}
+#endif
+
+// Function to read a batch of queries, one "NUM keyword1 ... keywordN" per line; blank lines are skipped
+bool readBatch(const string& filename, vector<BatchQuery>& queries) {
+    ifstream file(filename);
+    if (!file.is_open()) {
+        cerr << "Unable to open file " << filename << endl;
+        return false;
+    }
+
+    string line;
+    while (getline(file, line)) {
+        if (!line.empty() && line.back() == '\r') {
+            line.pop_back();
+        }
+        if (line.find_first_not_of(" \t") == string::npos) {
+            continue;
+        }
+        BatchQuery query;
+        query.line = line;
+        stringstream fields(line);
+        int numResults;
+        if (fields >> numResults && numResults >= 0) {
+            query.numResults = numResults;
+        }
+        queries.push_back(move(query));
+    }
+    return true;
+}
+
+// Function to write the answers of a batch: one combined file, or one results file per query in outputDir
+bool writeBatch(const vector<BatchQuery>& queries, const string& outputFile, const string& outputDir) {
+    if (outputDir.empty()) {
+        ofstream out(outputFile);
+        if (!out.is_open()) {
+            cerr << "Unable to open file " << outputFile << endl;
+            return false;
+        }
+        // Each answer repeats its query line and ends with an empty line, like the server's answers
+        for (const auto& query : queries) {
+            out << "Query: " << query.line << "\n";
+            if (query.numResults < 0) {
+                out << "Error: " << (query.error.empty() ? "expected NUM keyword1 keyword2 ... keywordN" : query.error) << "\n";
+            }
+            writeResults(out, query.results, query.numResults);
+            out << "\n";
+        }
+        return static_cast<bool>(out);
+    }
+
+    for (size_t q = 0; q < queries.size(); q++) {
+        if (queries[q].numResults < 0) {
+            cerr << "Skipping invalid query " << q + 1 << ": " << queries[q].line << endl;
+            continue;
+        }
+        string filename = outputDir + "/results" + to_string(q + 1) + ".txt";
+        ofstream out(filename);
+        if (!out.is_open()) {
+            cerr << "Unable to open file " << filename << endl;
+            return false;
+        }
+        writeResults(out, queries[q].results, queries[q].numResults);
+    }
+    return true;
+}
+
+// Function to load a saved index as one profiled stage
+bool loadSavedIndex(const string& indexFile, InvertedIndex& index, Profiler& profiler) {
+    beginStage(profiler);
+    if (!readIndex(indexFile, index)) {
+        return false;
+    }
+    endStage(profiler, "load index", fileSize(indexFile), index.liveDocuments, 0);
+    return true;
+}
+
+void printUsage(const char* program) {
+    cerr << "Usage: " << program << " [--profile [FILE]] [options] NUM keyword1 keyword2 ... keywordN" << endl;
+    cerr << "       " << program << " --build-index [INDEX]" << endl;
+    cerr << "       " << program << " --index [INDEX] NUM keyword1 keyword2 ... keywordN" << endl;
+    cerr << "       " << program << " [--index [INDEX]] --serve [--socket ADDRESS] [--cache-size MB]" << endl;
+    cerr << "       " << program << " [--index [INDEX]] --batch QUERIES [--output FILE | --output-dir DIR]" << endl;
+    cerr << "       " << program << " --shard I/N [--socket ADDRESS]" << endl;
+    cerr << "       " << program << " --shards N|ADDRESS,ADDRESS,... [--serve [--socket ADDRESS] | NUM keyword1 ... keywordN]" << endl;
+    cerr << "ADDRESS is HOST:PORT for TCP or the path of a Unix domain socket." << endl;
+}
+
+// Function to parse a shard number "I/N" (1 <= I <= N) into a 0-based shard and the number of shards
+bool parseShard(const string& text, uint32_t& shard, uint32_t& numShards) {
+    unsigned long i = 0;
+    unsigned long n = 0;
+    char slash = 0;
+    stringstream parser(text);
+    if (!(parser >> i >> slash >> n) || slash != '/' || i < 1 || i > n || n > 1024 || !parser.eof()) {
+        return false;
+    }
+    shard = static_cast<uint32_t>(i - 1);
+    numShards = static_cast<uint32_t>(n);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    string dictionaryFile = "data/dictionary.txt";
+    string stopwordsFile = "data/stopwords.txt";
+    string articleFile = "data/article.txt";
+    string indexFile = "data/index.bin";
+    string socketPath;
+    string batchFile;
+    string outputFile = "results.txt";
+    string outputDir;
+    string profileFile;
+    size_t cacheMegabytes = 64;
+    string shardList;
+    uint32_t shard = 0;
+    uint32_t numShards = 1;
+    bool buildIndexMode = false;
+    bool useIndex = false;
+    bool serveMode = false;
+
+    // Options come before the query
+    int argStart = 1;
+    while (argStart < argc && strncmp(argv[argStart], "--", 2) == 0) {
+        string option = argv[argStart++];
+        // The index and profile paths are optional; a numeric argument is the start of the query
+        bool hasPath = argStart < argc && strncmp(argv[argStart], "--", 2) != 0 && !isdigit(static_cast<unsigned char>(argv[argStart][0]));
+        if (option == "--build-index" || option == "--index") {
+            if (hasPath) {
+                indexFile = argv[argStart++];
+            }
+            (option == "--build-index" ? buildIndexMode : useIndex) = true;
+        } else if (option == "--profile") {
+            profileFile = hasPath ? argv[argStart++] : "profile.json";
+        } else if (option == "--serve") {
+            serveMode = true;
+        } else if (option == "--socket" && argStart < argc) {
+            serveMode = true;
+            socketPath = argv[argStart++];
+        } else if (option == "--cache-size" && argStart < argc && isdigit(static_cast<unsigned char>(argv[argStart][0]))) {
+            cacheMegabytes = strtoul(argv[argStart++], nullptr, 10);
+        } else if (option == "--shard" && argStart < argc) {
+            serveMode = true;
+            if (!parseShard(argv[argStart++], shard, numShards)) {
+                cerr << "--shard needs I/N with 1 <= I <= N" << endl;
+                return 1;
+            }
+        } else if (option == "--shards" && argStart < argc) {
+            shardList = argv[argStart++];
+        } else if (option == "--batch" && argStart < argc) {
+            batchFile = argv[argStart++];
+        } else if (option == "--output" && argStart < argc) {
+            outputFile = argv[argStart++];
+        } else if (option == "--output-dir" && argStart < argc) {
+            outputDir = argv[argStart++];
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    // Coordinator mode: the corpus is held by shard workers, local ones started here or ones already listening
+    if (!shardList.empty()) {
+#ifndef _WIN32
+        if (buildIndexMode || useIndex || !batchFile.empty()) {
+            cerr << "--shards only answers queries; each shard reads the corpus itself" << endl;
+            return 1;
+        }
+        if (!serveMode && argc < argStart + 2) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        vector<string> addresses;
+        vector<pid_t> workers;
+        if (isdigit(static_cast<unsigned char>(shardList[0])) && shardList.find_first_not_of("0123456789") == string::npos) {
+            uint32_t count = static_cast<uint32_t>(strtoul(shardList.c_str(), nullptr, 10));
+            if (count < 1 || count > 1024 || !startLocalShards(argv[0], count, addresses, workers)) {
+                stopLocalShards(addresses, workers);
+                cerr << "--shards needs between 1 and 1024 local shards" << endl;
+                return 1;
+            }
+        } else {
+            stringstream list(shardList);
+            string address;
+            while (getline(list, address, ',')) {
+                if (!address.empty()) {
+                    addresses.push_back(address);
+                }
+            }
+        }
+
+        auto start = high_resolution_clock::now(); // Start timing
+        vector<ShardConnection> shards;
+        bool answered = connectShards(addresses, workers, shards);
+        auto end = high_resolution_clock::now(); // End timing
+        if (answered && serveMode) {
+            cerr << "Connected to " << shards.size() << " shards in " << duration_cast<milliseconds>(end - start).count() << " milliseconds." << endl;
+            auto answerLine = [&shards](const string& line) {
+                return answerShardedQuery(shards, line);
+            };
+            if (socketPath.empty()) {
+                serveStream(cin, cout, answerLine);
+            } else {
+                cerr << "Listening on " << socketPath << endl;
+                answered = serveSocket(socketPath, answerLine);
+            }
+        } else if (answered) {
+            int numResults = stoi(argv[argStart]);
+            vector<string> keywords(argv + argStart + 1, argv + argc);
+
+            start = high_resolution_clock::now(); // Start timing
+            vector<pair<double, pair<int, string>>> scores; // <score, <docIndex, docID>>
+            string error;
+            answered = searchShards(shards, keywords, max(numResults, 5), scores, error);
+            if (!answered) {
+                cerr << "Error: " << error << endl;
+            } else {
+                // Output the top 5 results to the screen
+                cout << endl << "Top 5 results:" << endl;
+                writeResults(cout, scores, 5);
+                end = high_resolution_clock::now(); // End timing
+                cout << "Time taken: " << duration_cast<milliseconds>(end - start).count() << " milliseconds" << endl;
+
+                // Output the top N results to the results.txt file
+                ofstream resultFile("results.txt");
+                writeResults(resultFile, scores, numResults);
+            }
+        }
+
+        for (const auto& connection : shards) {
+            close(connection.fd);
+        }
+        stopLocalShards(addresses, workers);
+        return answered ? 0 : 1;
+#else
+        cerr << "Sharding is not supported on this platform" << endl;
+        return 1;
+#endif
+    }
+
+    // Index build mode: preprocess the corpus once and save the inverted index
+    if (buildIndexMode) {
+        auto start = high_resolution_clock::now(); // Start timing
+
+        Profiler profiler;
+        InvertedIndex index;
+        if (!loadCorpus(dictionaryFile, stopwordsFile, articleFile, index, cout, profiler)) {
+            return 1;
+        }
+        beginStage(profiler);
+        if (!writeIndex(indexFile, index)) {
+            return 1;
+        }
+        endStage(profiler, "write index", fileSize(indexFile), index.liveDocuments, 0);
+
+        auto end = high_resolution_clock::now(); // End timing
+        cout << "Indexed " << index.liveDocuments << " documents and " << countIndexedTerms(index) << " terms into " << indexFile << endl;
+        cout << "Time taken: " << duration_cast<milliseconds>(end - start).count() << " milliseconds" << endl;
+        return profileFile.empty() || writeProfile(profiler, profileFile, "build-index", {}) ? 0 : 1;
+    }
+
+    // Server mode: build or load the corpus once, then answer queries until the input ends
+    if (serveMode) {
+        auto start = high_resolution_clock::now(); // Start timing
+
+        if (useIndex && numShards > 1) {
+            cerr << "A saved index holds the whole corpus and cannot be served as a shard" << endl;
+            return 1;
+        }
+        Profiler profiler;
+        InvertedIndex index;
+        if (useIndex ? !loadSavedIndex(indexFile, index, profiler) : !loadCorpus(dictionaryFile, stopwordsFile, articleFile, index, cerr, profiler, shard, numShards)) {
+            return 1;
+        }
+        index.numShards = numShards;
+        if (useIndex) {
+            // Added documents may use words the saved corpus never contained
+            unordered_set<string> dictionary;
+            readWords(dictionaryFile, dictionary);
+            unordered_set<string> stopwords;
+            readWords(stopwordsFile, stopwords);
+            if (!dictionary.empty()) {
+                extendVocabulary(index, buildVocabulary(dictionary, stopwords));
+            }
+        }
+
+        auto end = high_resolution_clock::now(); // End timing
+        // Answers go to stdout, so status messages go to stderr
+        cerr << "Loaded " << index.liveDocuments << " documents and " << countIndexedTerms(index) << " terms in "
+             << duration_cast<milliseconds>(end - start).count() << " milliseconds." << endl;
+        // Only loading is profiled; queries report their own times
+        if (!profileFile.empty() && !writeProfile(profiler, profileFile, "serve", {})) {
+            return 1;
+        }
+
+        ResultCache cache;
+        cache.capacityBytes = cacheMegabytes << 20;
+        auto answerLine = [&index, &cache](const string& line) {
+            return answerQuery(index, cache, line);
+        };
+        startMerging(index);
+        bool served = true;
+        if (socketPath.empty()) {
+            serveStream(cin, cout, answerLine);
+        } else {
+#ifndef _WIN32
+            cerr << "Listening on " << socketPath << endl;
+            served = serveSocket(socketPath, answerLine);
+#else
+            cerr << "Unix sockets are not supported on this platform" << endl;
+            served = false;
+#endif
+        }
+        stopMerging(index);
+        return served ? 0 : 1;
+    }
+
+    // Batch mode: answer a file of queries, sharing the decoded posting lists between queries with common terms
+    if (!batchFile.empty()) {
+        vector<BatchQuery> queries;
+        if (!readBatch(batchFile, queries)) {
+            return 1;
+        }
+
+        Profiler profiler;
+        InvertedIndex index;
+        if (useIndex ? !loadSavedIndex(indexFile, index, profiler) : !loadCorpus(dictionaryFile, stopwordsFile, articleFile, index, cout, profiler)) {
+            return 1;
+        }
+
+        auto start = high_resolution_clock::now(); // Start timing
+        beginStage(profiler);
+        size_t decodedPostings = searchBatch(index, queries);
+        endStage(profiler, "score", 0, queries.size(), decodedPostings);
+        auto end = high_resolution_clock::now(); // End timing
+
+        beginStage(profiler);
+        if (!writeBatch(queries, outputFile, outputDir)) {
+            return 1;
+        }
+        endStage(profiler, "write", outputDir.empty() ? fileSize(outputFile) : 0, queries.size(), 0);
+        cout << "Answered " << queries.size() << " queries, decoding " << decodedPostings << " postings." << endl;
+        cout << "Time taken: " << duration_cast<milliseconds>(end - start).count() << " milliseconds" << endl;
+        return profileFile.empty() || writeProfile(profiler, profileFile, "batch", {}) ? 0 : 1;
+    }
+
+    if (argc < argStart + 2) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    int numResults = stoi(argv[argStart]);
+    vector<string> keywords;
+    for (int i = argStart + 1; i < argc; ++i) {
+        keywords.push_back(argv[i]);
+    }
+    BooleanQuery booleanQuery;
+    bool boolean = isBooleanQuery(keywords);
+    string error;
+    if (boolean && !parseBooleanQuery(keywords, booleanQuery, error)) {
+        cerr << "Invalid query: " << error << endl;
+        return 1;
+    }
+
+    // Load a saved inverted index, or read the corpus and build the index in memory
+    Profiler profiler;
+    InvertedIndex index;
+    if (useIndex) {
+        if (!loadSavedIndex(indexFile, index, profiler)) {
+            return 1;
+        }
+        cout << "Loaded index with " << index.liveDocuments << " documents and " << countIndexedTerms(index) << " terms." << endl;
+    } else if (!loadCorpus(dictionaryFile, stopwordsFile, articleFile, index, cout, profiler)) {
+        return 1;
+    }
+
+    // The Main Algorithms stars from here
+    auto start = high_resolution_clock::now(); // Start timing
+
+    // Score the documents containing the keywords, keeping only the best NUM (and at least 5 for the screen).
+    // IDF, scoring and the top NUM selection are one stage.
+    beginStage(profiler);
+    vector<pair<double, pair<int, string>>> scores; // <score, <docIndex, docID>>
+    size_t decodedPostings = 0;
+    if (boolean) {
+        scores = searchBoolean(index, booleanQuery, max(numResults, 5), nullptr, &decodedPostings);
+    } else {
+        scores = searchIndex(index, keywords, max(numResults, 5), nullptr, &decodedPostings);
+    }
+    endStage(profiler, "score", 0, index.liveDocuments, decodedPostings);
+
+    // Output the top 5 results to the screen
+    beginStage(profiler);
+    cout << endl << "Top 5 results:" << endl;
+    writeResults(cout, scores, 5);
+
+    auto end = high_resolution_clock::now(); // End timing
+    auto duration = duration_cast<milliseconds>(end - start).count(); // Calculate the elapsed time in milliseconds
+
+    cout << "Time taken: " << duration << " milliseconds" << endl; // Output the elapsed time
+
+    // Output the top N results to the results.txt file
+    ofstream resultFile("results.txt");
+    writeResults(resultFile, scores, numResults);
+    resultFile.close();
+    endStage(profiler, "write", fileSize("results.txt"), min(numResults, static_cast<int>(scores.size())), 0);
+
+    return profileFile.empty() || writeProfile(profiler, profileFile, "query", keywords) ? 0 : 1;
 }